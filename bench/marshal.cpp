@@ -0,0 +1,117 @@
+// Copyright (c) Benjamin Kietzman (github.com/bkietz)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+// Cost of encoding and decoding message bodies.
+//
+// Each payload is packed into a fresh method call through DBusMessageIter
+// (message::pack) and through the native wire writer (wire::marshal), then
+// decoded again through message::unpack and wire::unmarshal.
+//
+// Usage: marshal_bench [iterations]   (default: 20000)
+
+#include <dbus/message.hpp>
+#include <dbus/wire.hpp>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <string>
+#include <tuple>
+#include <vector>
+
+namespace {
+
+typedef std::chrono::steady_clock clock_type;
+
+dbus::message new_call() {
+  return dbus::message::new_call(
+      dbus::endpoint("org.test", "/org/test", "org.test.Interface"), "Bench");
+}
+
+template <typename F>
+double ns_per_op(std::size_t iterations, F&& f) {
+  for (std::size_t i = 0; i < iterations / 10; ++i) f();  // warm up
+  auto start = clock_type::now();
+  for (std::size_t i = 0; i < iterations; ++i) f();
+  return std::chrono::duration<double, std::nano>(clock_type::now() - start)
+             .count() /
+         iterations;
+}
+
+// Does not let the optimizer drop a result.
+volatile std::size_t sink;
+
+template <typename... Args>
+void run(const char* name, std::size_t iterations, const Args&... args) {
+  double pack = ns_per_op(iterations, [&] {
+    dbus::message m = new_call();
+    m.pack(args...);
+    sink = sink + (m != nullptr);
+  });
+  double marshal = ns_per_op(iterations, [&] {
+    dbus::message header = new_call();
+    dbus::message m = dbus::wire::marshal(header, args...);
+    sink = sink + (m != nullptr);
+  });
+
+  dbus::message m = new_call();
+  m.pack(args...);
+  double unpack = ns_per_op(iterations, [&] {
+    std::tuple<Args...> out;
+    sink = sink + std::apply([&](auto&... o) { return m.unpack(o...); }, out);
+  });
+  double unmarshal = ns_per_op(iterations, [&] {
+    std::tuple<Args...> out;
+    sink = sink + std::apply(
+                      [&](auto&... o) { return dbus::wire::unmarshal(m, o...); },
+                      out);
+  });
+
+  std::printf("%-10s %10.0f  %10.0f  %10.0f  %10.0f\n", name, pack, marshal,
+              unpack, unmarshal);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  std::size_t iterations = argc > 1 ? std::strtoul(argv[1], 0, 10) : 20000;
+
+  std::vector<std::string> strings;
+  for (int i = 0; i < 16; ++i) {
+    strings.push_back("org.example.Property" + std::to_string(i));
+  }
+
+  std::map<std::string, dbus::dbus_variant> properties;
+  for (int i = 0; i < 64; ++i) {
+    dbus::dbus_variant v;
+    switch (i % 4) {
+      case 0: v = std::string("value") + std::to_string(i); break;
+      case 1: v = dbus::int32(i); break;
+      case 2: v = i * 0.5; break;
+      default: v = (i & 8) != 0; break;
+    }
+    properties.emplace("Property" + std::to_string(i), v);
+  }
+
+  std::vector<std::map<std::string, std::vector<dbus::int32>>> nested(8);
+  for (int i = 0; i < 8; ++i) {
+    for (int j = 0; j < 8; ++j) {
+      nested[i]["key" + std::to_string(j)] = {i, j, i * j, i + j};
+    }
+  }
+
+  std::vector<dbus::byte> blob(64 * 1024, 0x5a);
+
+  std::printf("%-10s %10s  %10s  %10s  %10s\n", "payload", "pack ns",
+              "marshal ns", "unpack ns", "unmarsh ns");
+  run("scalars", iterations, dbus::int32(1), dbus::uint64(2), 3.0, true,
+      dbus::int16(4), dbus::byte(5));
+  run("strings", iterations, strings);
+  run("a{sv}", iterations, properties);
+  run("nested", iterations, nested);
+  run("ay 64KiB", iterations / 10 + 1, blob);
+  return 0;
+}
@@ -0,0 +1,75 @@
+// Copyright (c) Benjamin Kietzman (github.com/bkietz)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+// Cost of building the same call or signal over and over.
+//
+// Each message gets a small body, as a poller's would. Building the header
+// from an endpoint every time is compared with copying it from a
+// message_template.
+//
+// Usage: message_template_bench [iterations]   (default: 200000)
+
+#include <dbus/message.hpp>
+#include <dbus/message_template.hpp>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+namespace {
+
+typedef std::chrono::steady_clock clock_type;
+
+volatile std::size_t sink;
+
+template <typename F>
+double ns_per_op(std::size_t iterations, F&& f) {
+  for (std::size_t i = 0; i < iterations / 10; ++i) f();  // warm up
+  auto start = clock_type::now();
+  for (std::size_t i = 0; i < iterations; ++i) f();
+  return std::chrono::duration<double, std::nano>(clock_type::now() - start)
+             .count() /
+         iterations;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  std::size_t iterations = argc > 1 ? std::strtoul(argv[1], 0, 10) : 200000;
+
+  dbus::endpoint sensor("org.example.Sensors", "/org/example/Sensors/cpu0",
+                        "org.freedesktop.DBus.Properties", "Get");
+  std::string interface("org.example.Sensor");
+  std::string property("Temperature");
+
+  double call = ns_per_op(iterations, [&] {
+    dbus::message m = dbus::message::new_call(sensor);
+    m.pack(interface, property);
+    sink = sink + (m != nullptr);
+  });
+  auto call_template = dbus::message_template::call(sensor);
+  double call_copy = ns_per_op(iterations, [&] {
+    dbus::message m = call_template.create(interface, property);
+    sink = sink + (m != nullptr);
+  });
+
+  dbus::endpoint origin("", "/org/example/Sensors/cpu0", "org.example.Sensor");
+  double signal = ns_per_op(iterations, [&] {
+    dbus::message m = dbus::message::new_signal(origin, "Reading");
+    m.pack(42.0);
+    sink = sink + (m != nullptr);
+  });
+  auto signal_template = dbus::message_template::signal(origin, "Reading");
+  double signal_copy = ns_per_op(iterations, [&] {
+    dbus::message m = signal_template.create(42.0);
+    sink = sink + (m != nullptr);
+  });
+
+  std::printf("%-8s %12s  %12s\n", "message", "new_* ns", "template ns");
+  std::printf("%-8s %12.0f  %12.0f\n", "call", call, call_copy);
+  std::printf("%-8s %12.0f  %12.0f\n", "signal", signal, signal_copy);
+  return 0;
+}
@@ -0,0 +1,86 @@
+// Copyright (c) Benjamin Kietzman (github.com/bkietz)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+// Cost of finding the object a method call is addressed to.
+//
+// The object server used to compare the path of every call with each
+// registered object in turn; objects are now registered with libdbus, whose
+// object path tree is searched instead. Both are timed for the first, middle
+// and last of 10k objects. Needs a session bus to register paths on.
+//
+// Usage: object_paths_bench [iterations]   (default: 100000)
+
+#include <dbus/dbus.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+namespace {
+
+typedef std::chrono::steady_clock clock_type;
+
+volatile std::size_t sink;
+
+template <typename F>
+double ns_per_op(std::size_t iterations, F&& f) {
+  for (std::size_t i = 0; i < iterations / 10; ++i) f();  // warm up
+  auto start = clock_type::now();
+  for (std::size_t i = 0; i < iterations; ++i) f();
+  return std::chrono::duration<double, std::nano>(clock_type::now() - start)
+             .count() /
+         iterations;
+}
+
+DBusHandlerResult handle(DBusConnection*, DBusMessage*, void*) {
+  return DBUS_HANDLER_RESULT_HANDLED;
+}
+
+const std::size_t objects = 10000;
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  std::size_t iterations = argc > 1 ? std::strtoul(argv[1], 0, 10) : 100000;
+
+  DBusConnection* conn = dbus_bus_get_private(DBUS_BUS_SESSION, NULL);
+  if (conn == NULL) {
+    std::fprintf(stderr, "no session bus\n");
+    return 1;
+  }
+
+  static const DBusObjectPathVTable vtable = {NULL, &handle};
+  std::vector<std::string> names;
+  for (std::size_t i = 0; i < objects; ++i) {
+    names.push_back("/org/example/Sensors/sensor" + std::to_string(i));
+    dbus_connection_register_object_path(conn, names.back().c_str(), &vtable,
+                                         &names);
+  }
+
+  std::printf("%-8s %10s  %10s\n", "object", "scan ns", "tree ns");
+  for (std::size_t i : {std::size_t(0), objects / 2, objects - 1}) {
+    std::string path = names[i];
+    double scan = ns_per_op(iterations / 10, [&] {
+      for (auto& name : names) {
+        if (name == path) {
+          sink = sink + 1;
+          break;
+        }
+      }
+    });
+    double tree = ns_per_op(iterations, [&] {
+      void* data = NULL;
+      dbus_connection_get_object_path_data(conn, path.c_str(), &data);
+      sink = sink + (data != NULL);
+    });
+    std::printf("%-8zu %10.0f  %10.0f\n", i, scan, tree);
+  }
+
+  dbus_connection_close(conn);
+  dbus_connection_unref(conn);
+  return 0;
+}
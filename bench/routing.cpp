@@ -0,0 +1,88 @@
+// Copyright (c) Benjamin Kietzman (github.com/bkietz)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+// Cost of finding the filter an incoming message belongs to.
+//
+// Each subscription accepts one signal member. Predicates written as the
+// filters used to be, comparing std::string copies of the headers, are
+// compared with routes looked up in the connection's router. The message
+// belongs to the last subscription, which is the worst case for predicates.
+//
+// Usage: routing_bench [iterations]   (default: 200000)
+
+#include <dbus/detail/router.hpp>
+#include <dbus/endpoint.hpp>
+#include <dbus/message.hpp>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace {
+
+typedef std::chrono::steady_clock clock_type;
+
+volatile std::size_t sink;
+
+template <typename F>
+double ns_per_op(std::size_t iterations, F&& f) {
+  for (std::size_t i = 0; i < iterations / 10; ++i) f();  // warm up
+  auto start = clock_type::now();
+  for (std::size_t i = 0; i < iterations; ++i) f();
+  return std::chrono::duration<double, std::nano>(clock_type::now() - start)
+             .count() /
+         iterations;
+}
+
+const char* interface = "org.example.Sensor";
+
+std::string member(std::size_t i) { return "Reading" + std::to_string(i); }
+
+double run(std::size_t subscriptions, std::size_t iterations, bool routed) {
+  asio::io_context io;
+  dbus::detail::dispatch_context ctx(io, false);
+  dbus::detail::queue<dbus::message> q(ctx);
+  dbus::detail::router router;
+
+  std::vector<std::unique_ptr<dbus::detail::router::entry>> entries;
+  for (std::size_t i = 0; i < subscriptions; ++i) {
+    entries.emplace_back(new dbus::detail::router::entry);
+    auto& e = *entries.back();
+    std::string name = member(i);
+    if (routed) {
+      e.r = dbus::route{dbus::message_type::signal, interface, name};
+    } else {
+      e.predicate = [name](dbus::message& m) {
+        return m.get_type() == "signal" && m.get_interface() == interface &&
+               m.get_member() == name;
+      };
+    }
+    e.target = &q;
+    router.add(e);
+  }
+
+  dbus::message m = dbus::message::new_signal(
+      dbus::endpoint("", "/org/example/Sensors/cpu0", interface),
+      member(subscriptions - 1));
+  return ns_per_op(iterations, [&] { sink = sink + (router.find(m) != 0); });
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  std::size_t iterations = argc > 1 ? std::strtoul(argv[1], 0, 10) : 200000;
+
+  std::printf("%-14s %14s  %10s\n", "subscriptions", "predicate ns",
+              "route ns");
+  for (std::size_t n : {1, 10, 1000}) {
+    std::size_t i = n > 10 ? iterations / 100 : iterations;
+    std::printf("%-14zu %14.0f  %10.0f\n", n, run(n, i, false),
+                run(n, i, true));
+  }
+  return 0;
+}
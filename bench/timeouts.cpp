@@ -0,0 +1,196 @@
+// Copyright (c) Benjamin Kietzman (github.com/bkietz)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+// Cost of keeping libdbus timeouts for many outstanding calls.
+//
+// Each round adds one timeout per call, as libdbus does for a pending call,
+// then removes them all again, as happens when the replies arrive. The timer
+// wheel backing connections is compared with the previous scheme of one
+// heap allocated steady_timer per timeout.
+//
+// Usage: timeouts_bench [calls...]   (default: 1000 10000 100000)
+
+#include <dbus/detail/timer_wheel.hpp>
+
+#include <asio/io_context.hpp>
+#include <asio/steady_timer.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <new>
+#include <vector>
+
+namespace {
+
+std::atomic<std::size_t> live_bytes{0};
+std::atomic<std::size_t> peak_bytes{0};
+std::atomic<std::size_t> allocations{0};
+
+struct header {
+  std::size_t size;
+  std::max_align_t align;
+};
+
+}  // namespace
+
+void* operator new(std::size_t n) {
+  void* p = std::malloc(n + sizeof(header));
+  if (p == nullptr) throw std::bad_alloc();
+  static_cast<header*>(p)->size = n;
+  std::size_t live = live_bytes += n;
+  std::size_t peak = peak_bytes.load();
+  while (live > peak && !peak_bytes.compare_exchange_weak(peak, live)) {
+  }
+  ++allocations;
+  return static_cast<header*>(p) + 1;
+}
+
+void operator delete(void* p) noexcept {
+  if (p == nullptr) return;
+  header* h = static_cast<header*>(p) - 1;
+  live_bytes -= h->size;
+  std::free(h);
+}
+
+void operator delete(void* p, std::size_t) noexcept { operator delete(p); }
+
+namespace {
+
+typedef std::chrono::steady_clock clock_type;
+
+struct result {
+  double add_us;
+  double remove_us;
+  std::size_t bytes;
+  std::size_t allocations;
+};
+
+void reset_counters() {
+  peak_bytes = live_bytes.load();
+  allocations = 0;
+}
+
+double elapsed_us(clock_type::time_point since) {
+  return std::chrono::duration<double, std::micro>(clock_type::now() - since)
+      .count();
+}
+
+// The scheme used before the timer wheel: a shared timer object per timeout,
+// held through a heap allocated shared_ptr set as the timeout's data.
+struct legacy_timeout : std::enable_shared_from_this<legacy_timeout> {
+  asio::steady_timer timer;
+  std::size_t serial = 0;
+
+  explicit legacy_timeout(asio::io_context& io) : timer(io) {}
+
+  void arm(asio::steady_timer::duration interval) {
+    disarm();
+    timer.expires_after(interval);
+    timer.async_wait([ this, id = serial, self = shared_from_this() ](
+        const asio::error_code& ec) {
+      if (ec || serial != id) return;
+    });
+  }
+
+  void disarm() {
+    serial += 1;
+    timer.cancel();
+  }
+};
+
+result run_legacy(std::size_t calls) {
+  asio::io_context io;
+  std::vector<std::shared_ptr<legacy_timeout>*> timeouts;
+  timeouts.reserve(calls);
+  reset_counters();
+  std::size_t base = live_bytes;
+
+  auto start = clock_type::now();
+  for (std::size_t i = 0; i < calls; ++i) {
+    auto t = new std::shared_ptr<legacy_timeout>(
+        std::make_shared<legacy_timeout>(io));
+    (*t)->arm(std::chrono::seconds(25));
+    timeouts.push_back(t);
+  }
+  double add_us = elapsed_us(start);
+  std::size_t bytes = peak_bytes - base;
+  std::size_t allocs = allocations;
+
+  start = clock_type::now();
+  for (auto t : timeouts) {
+    (*t)->disarm();
+    delete t;
+  }
+  // the cancelled waits complete through the io_context
+  io.run();
+  double remove_us = elapsed_us(start);
+
+  return result{add_us, remove_us, bytes, allocs};
+}
+
+struct wheel_timeout : dbus::detail::timer_wheel::entry {
+  std::shared_ptr<dbus::detail::timer_wheel> wheel;
+
+  explicit wheel_timeout(std::shared_ptr<dbus::detail::timer_wheel> w)
+      : entry(&expired), wheel(std::move(w)) {}
+
+  ~wheel_timeout() { wheel->remove(*this); }
+
+  static void expired(entry&) {}
+};
+
+result run_wheel(std::size_t calls) {
+  asio::io_context io;
+  dbus::detail::dispatch_context ctx(io, false);
+  auto wheel = std::make_shared<dbus::detail::timer_wheel>(ctx);
+  std::vector<wheel_timeout*> timeouts;
+  timeouts.reserve(calls);
+  reset_counters();
+  std::size_t base = live_bytes;
+
+  auto start = clock_type::now();
+  for (std::size_t i = 0; i < calls; ++i) {
+    auto t = new wheel_timeout(wheel);
+    wheel->add(*t, std::chrono::seconds(25));
+    timeouts.push_back(t);
+  }
+  double add_us = elapsed_us(start);
+  std::size_t bytes = peak_bytes - base;
+  std::size_t allocs = allocations;
+
+  start = clock_type::now();
+  for (auto t : timeouts) {
+    delete t;
+  }
+  io.poll();
+  double remove_us = elapsed_us(start);
+
+  return result{add_us, remove_us, bytes, allocs};
+}
+
+void print(const char* name, std::size_t calls, const result& r) {
+  std::printf("%-8s %8zu  %10.0f  %10.0f  %10.1f  %12zu  %8.1f\n", name, calls,
+              r.add_us, r.remove_us, r.bytes / 1024.0, r.allocations,
+              double(r.bytes) / calls);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  std::vector<std::size_t> sizes;
+  for (int i = 1; i < argc; ++i) sizes.push_back(std::strtoul(argv[i], 0, 10));
+  if (sizes.empty()) sizes = {1000, 10000, 100000};
+
+  std::printf("%-8s %8s  %10s  %10s  %10s  %12s  %8s\n", "scheme", "calls",
+              "add us", "remove us", "peak KiB", "allocations", "B/call");
+  for (std::size_t calls : sizes) {
+    print("timer", calls, run_legacy(calls));
+    print("wheel", calls, run_wheel(calls));
+  }
+  return 0;
+}
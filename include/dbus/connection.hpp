@@ -7,16 +7,26 @@
 #define DBUS_CONNECTION_HPP
 
 #include <dbus/connection_service.hpp>
+#include <dbus/detail/bus_batch_op.hpp>
+#include <dbus/detail/cancellation.hpp>
+#include <dbus/detail/match_registry.hpp>
+#include <dbus/detail/method_call_op.hpp>
 #include <dbus/element.hpp>
 #include <dbus/message.hpp>
 #include <chrono>
+#include <cstdint>
+#include <functional>
 #include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
 #include <asio.hpp>
 
 namespace dbus {
 
 class filter;
 class match;
+class signal_hub;
 
 /// Root D-Bus IO object
 /**
@@ -31,11 +41,15 @@ class connection : public asio::basic_io_object<connection_service> {
  *
  * @param address The address of the bus to connect to.
  *
+ * @param t How the connection schedules its internal work. Pass
+ * threading::strand when the io_context is run from more than one thread.
+ *
  * @throws asio::system_error When opening the connection failed.
  */
-  connection(asio::io_context& io, const string& address)
+  connection(asio::io_context& io, const string& address,
+             threading t = threading::single)
       : basic_io_object<connection_service>(io) {
-    this->get_service().open(this->get_implementation(), address);
+    this->get_service().open(this->get_implementation(), address, t);
   }
 
   /// Open a connection to a well-known bus.
@@ -45,12 +59,16 @@ class connection : public asio::basic_io_object<connection_service> {
  *
  * @param bus The well-known bus to connect to.
  *
+ * @param t How the connection schedules its internal work. Pass
+ * threading::strand when the io_context is run from more than one thread.
+ *
  * @throws asio::system_error When opening the connection failed.
  */
   // TODO: change this unsigned to an enumeration
-  connection(asio::io_context& io, const int bus)
+  connection(asio::io_context& io, const int bus,
+             threading t = threading::single)
       : basic_io_object<connection_service>(io) {
-    this->get_service().open(this->get_implementation(), bus);
+    this->get_service().open(this->get_implementation(), bus, t);
   }
 
   /// Request a name on the bus.
@@ -79,6 +97,134 @@ class connection : public asio::basic_io_object<connection_service> {
     this->get_implementation().release_name(name);
   }
 
+  /// Request a name on the bus asynchronously.
+  /**
+ * @param name The name requested on the bus.
+ *
+ * @param flags DBUS_NAME_FLAG_* flags. The overload without flags uses the
+ * same ones as request_name().
+ *
+ * @param token Completion token with the signature
+ * void(asio::error_code, std::uint32_t). On success the second argument is
+ * the bus daemon's reply, one of the DBUS_REQUEST_NAME_REPLY_* codes.
+ */
+  template <typename CompletionToken>
+  auto async_request_name(const string& name, std::uint32_t flags,
+                          CompletionToken&& token) {
+    return async_method_call_impl<std::uint32_t>(
+        detail::bus_endpoint("RequestName"), std::forward_as_tuple(name, flags),
+        std::forward<CompletionToken>(token), std::make_index_sequence<2>());
+  }
+
+  template <typename CompletionToken>
+  auto async_request_name(const string& name, CompletionToken&& token) {
+    return async_request_name(name, default_name_flags,
+                              std::forward<CompletionToken>(token));
+  }
+
+  /// Request many names on the bus asynchronously, in one round trip.
+  /**
+ * All requests are queued before the first reply is read.
+ *
+ * @param flags DBUS_NAME_FLAG_* flags applied to every name. The overload
+ * without flags uses the same ones as request_name().
+ *
+ * @param token Completion token with the signature
+ * void(asio::error_code, std::vector<std::uint32_t>). The vector holds the
+ * DBUS_REQUEST_NAME_REPLY_* code for each name, in order, or 0 for a request
+ * that failed; the error code is that of the first failure.
+ */
+  template <typename CompletionToken>
+  auto async_request_names(const std::vector<string>& names,
+                           std::uint32_t flags, CompletionToken&& token) {
+    std::vector<message> calls;
+    asio::error_code ec =
+        detail::new_bus_calls("RequestName", names, calls, flags);
+    return asio::async_initiate<CompletionToken,
+                                void(asio::error_code,
+                                     std::vector<std::uint32_t>)>(
+        detail::initiate_bus_batch<connection, std::uint32_t>{*this}, token,
+        std::move(calls), ec);
+  }
+
+  template <typename CompletionToken>
+  auto async_request_names(const std::vector<string>& names,
+                           CompletionToken&& token) {
+    return async_request_names(names, default_name_flags,
+                               std::forward<CompletionToken>(token));
+  }
+
+  /// Release a name on the bus asynchronously.
+  /**
+ * @param token Completion token with the signature
+ * void(asio::error_code, std::uint32_t). On success the second argument is
+ * one of the DBUS_RELEASE_NAME_REPLY_* codes.
+ */
+  template <typename CompletionToken>
+  auto async_release_name(const string& name, CompletionToken&& token) {
+    return async_method_call_impl<std::uint32_t>(
+        detail::bus_endpoint("ReleaseName"), std::forward_as_tuple(name),
+        std::forward<CompletionToken>(token), std::make_index_sequence<1>());
+  }
+
+  /// Install a match rule asynchronously.
+  /**
+ * Unlike a dbus::match, the rule is neither counted in get_match_rules() nor
+ * removed automatically; see async_remove_match() and dbus::match_set.
+ *
+ * @param token Completion token with the signature void(asio::error_code),
+ * called once the bus daemon has acknowledged the rule.
+ */
+  template <typename CompletionToken>
+  auto async_add_match(const string& rule, CompletionToken&& token) {
+    return async_bus_batch("AddMatch", std::vector<string>{rule},
+                           std::forward<CompletionToken>(token));
+  }
+
+  /// Remove a match rule asynchronously.
+  /**
+ * @param token Completion token with the signature void(asio::error_code).
+ */
+  template <typename CompletionToken>
+  auto async_remove_match(const string& rule, CompletionToken&& token) {
+    return async_bus_batch("RemoveMatch", std::vector<string>{rule},
+                           std::forward<CompletionToken>(token));
+  }
+
+  /// The rules installed by dbus::match and dbus::match_set objects.
+  /**
+ * Equivalent expressions are listed once, in canonical form, with the
+ * number of objects holding them.
+ */
+  std::vector<match_rule_info> get_match_rules() {
+    return this->get_implementation().get_match_registry()->rules();
+  }
+
+  /// Hand the method calls for an object path straight to a handler.
+  /**
+   * libdbus finds the handler in its object path tree once no filter has
+   * taken the call. The handler runs while messages are dispatched, and
+   * returns false to leave the call unhandled, which gets the caller an
+   * UnknownMethod error. Other messages for the path, such as signals, are
+   * not passed to the handler.
+   *
+   * @param fallback Also handle the calls for paths below path that have no
+   * handler of their own.
+   *
+   * @throws asio::system_error When the path already has a handler.
+   */
+  void register_object_path(const string& path,
+                            std::function<bool(message&)> handler,
+                            bool fallback = false) {
+    this->get_implementation().register_object_path(path, std::move(handler),
+                                                    fallback);
+  }
+
+  /// Remove the handler of an object path.
+  void unregister_object_path(const string& path) {
+    this->get_implementation().unregister_object_path(path);
+  }
+
   std::string get_unique_name() {
     return this->get_implementation().get_unique_name();
   }
@@ -138,7 +284,9 @@ class connection : public asio::basic_io_object<connection_service> {
   /**
  * @param m The message to send.
  *
- * @param handler Handler for the reply.
+ * @param handler Handler for the reply. A cancellation slot bound to the
+ * handler (asio::bind_cancellation_slot) abandons the call: the handler
+ * completes at once with asio::error::operation_aborted.
  *
  * @return Asynchronous result
  */
@@ -162,44 +310,85 @@ class connection : public asio::basic_io_object<connection_service> {
     typedef std::tuple<Rest...> type;
   };
 
+  /// Call a method asynchronously, unpacking the reply into a handler's
+  /// arguments.
+  /**
+ * The types to unpack are taken from the handler's signature,
+ * void(asio::error_code, Results...). If the arguments cannot be packed, or
+ * the reply does not unpack, the handler is called with
+ * asio::error::invalid_argument.
+ */
   template <typename MessageHandler, typename... InputArgs>
   auto async_method_call(MessageHandler handler, const dbus::endpoint& e,
                          const InputArgs&... a) {
-    message m = dbus::message::new_call(e);
-    if (!m.pack(a...)) {
-      // TODO(ed) Set error code?
-      std::cerr << "Pack error\n";
-    } else {
-      // explicit copy of handler here.  At this time, not clear why a copy is
-      // needed
-      return async_send(
-          m, [handler](asio::error_code ec, dbus::message r) {
-            // Make a copy of the error code so we can modify it
-            typedef typename function_traits<MessageHandler>::decayed_arg_types
-                function_tuple;
-            typedef typename strip_first_arg<function_tuple>::type unpack_type;
-            unpack_type response_args;
-            if (!ec) {
-              if (!unpack_into_tuple(response_args, r)) {
-                // Set error code
-                ec = asio::error::invalid_argument;
-              }
-            }
-            // Should this (the callback) be done in a try catch block?
-            // should throwing from a handler flow all the way to the
-            // io_context?
-
-            // Note.  Callback is called whether or not the unpack was sucessful
-            // to allow the user to implement their own handling
-            index_apply<std::tuple_size<unpack_type>{}>([&](auto... Is) {
-              handler(ec, std::get<Is>(response_args)...);
-            });
-          });
-    }
+    typedef typename function_traits<typename detail::handler_target<
+        MessageHandler>::type>::decayed_arg_types function_tuple;
+    typedef typename strip_first_arg<function_tuple>::type unpack_type;
+
+    // The handler's cancellation slot is carried over to the wrapper, so the
+    // call stays cancellable.
+    auto slot = detail::get_cancellation_slot(handler);
+    return async_method_call_impl<unpack_type>(
+        e, std::forward_as_tuple(a...),
+        detail::bind_cancellation_slot(
+            slot, [handler = std::move(handler)](asio::error_code ec,
+                                                 unpack_type r) mutable {
+              // Note.  Callback is called whether or not the unpack was
+              // sucessful to allow the user to implement their own handling
+              index_apply<std::tuple_size<unpack_type>{}>([&](auto... Is) {
+                handler(ec, std::get<Is>(r)...);
+              });
+            }),
+        std::make_index_sequence<sizeof...(InputArgs)>());
+  }
+
+  /// Call a method asynchronously, with any completion token.
+  /**
+ * The last argument is the completion token; the ones before it are packed
+ * into the call. The reply is unpacked into a std::tuple<Results...>, so the
+ * completion signature is void(asio::error_code, std::tuple<Results...>):
+ *
+ * @code
+ * std::tuple<int, std::string> r = co_await conn.async_method_call<int,
+ *     std::string>(e, 42, asio::use_awaitable);
+ * @endcode
+ *
+ * If the arguments cannot be packed, or the reply does not unpack, the
+ * operation completes with asio::error::invalid_argument.
+ */
+  template <typename... Results, typename... Args>
+  auto async_method_call(const dbus::endpoint& e, Args&&... args) {
+    static_assert(sizeof...(Args) > 0, "a completion token is required");
+    auto t = std::forward_as_tuple(std::forward<Args>(args)...);
+    return async_method_call_impl<std::tuple<Results...>>(
+        e, t, std::get<sizeof...(Args) - 1>(std::move(t)),
+        std::make_index_sequence<sizeof...(Args) - 1>());
   }
 
   void flush(void) { this->get_implementation().flush(); };
 
+  /// Limit the work done each time incoming messages are dispatched.
+  /**
+ * A dispatch run handles up to max_messages messages, and stops early once
+ * max_time has elapsed, before rescheduling itself behind the other work
+ * queued on the io_context. The default is one message per run.
+ *
+ * @param max_messages Maximum number of messages per run.
+ *
+ * @param max_time Maximum time spent per run. Zero means no time limit.
+ */
+  void set_dispatch_budget(
+      std::size_t max_messages,
+      std::chrono::microseconds max_time = std::chrono::microseconds::zero()) {
+    this->get_implementation().get_dispatch_context().set_budget(max_messages,
+                                                                 max_time);
+  }
+
+  /// Counters for tuning the dispatch budget.
+  dispatch_stats get_dispatch_stats() {
+    return this->get_implementation().get_dispatch_context().get_stats();
+  }
+
   /// Create a new match.
   void new_match(match& m) {
     this->get_service().new_match(this->get_implementation(), m);
@@ -223,6 +412,52 @@ class connection : public asio::basic_io_object<connection_service> {
   // FIXME the only way around this I see is to expose start() here, which seems
   // ugly
   friend class filter;
+  friend class match;
+  friend class match_set;
+  friend class signal_hub;
+
+ private:
+  static constexpr std::uint32_t default_name_flags =
+      DBUS_NAME_FLAG_DO_NOT_QUEUE | DBUS_NAME_FLAG_REPLACE_EXISTING;
+
+  // Call a bus daemon method taking a single string once per element of
+  // args, in one round trip, and complete once every call is acknowledged.
+  template <typename CompletionToken>
+  auto async_bus_batch(const char* member, const std::vector<string>& args,
+                       CompletionToken&& token) {
+    std::vector<message> calls;
+    asio::error_code ec = detail::new_bus_calls(member, args, calls);
+    return asio::async_initiate<CompletionToken, void(asio::error_code)>(
+        detail::initiate_bus_batch<connection, void>{*this}, token,
+        std::move(calls), ec);
+  }
+
+  // AddMatch each rule not yet held by another match or match_set, and
+  // complete once all of them are acknowledged. Rules are in canonical form.
+  template <typename CompletionToken>
+  auto async_acquire_matches(std::vector<string> keys,
+                             CompletionToken&& token) {
+    return asio::async_initiate<CompletionToken, void(asio::error_code)>(
+        detail::initiate_add_matches<connection>{
+            *this, this->get_implementation().get_match_registry()},
+        token, std::move(keys));
+  }
+
+  template <typename Results, typename ArgsTuple, typename CompletionToken,
+            std::size_t... Is>
+  auto async_method_call_impl(const dbus::endpoint& e, const ArgsTuple& a,
+                              CompletionToken&& token,
+                              std::index_sequence<Is...>) {
+    message m = dbus::message::new_call(e);
+    asio::error_code ec;
+    if (!m.pack(std::get<Is>(a)...)) {
+      ec = asio::error::invalid_argument;
+    }
+    return asio::async_initiate<CompletionToken,
+                                void(asio::error_code, Results)>(
+        detail::initiate_method_call<connection, Results>{*this},
+        token, std::move(m), ec, -1);
+  }
 };
 
 }  // namespace dbus
@@ -0,0 +1,149 @@
+// Copyright (c) Benjamin Kietzman (github.com/bkietz)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+#ifndef DBUS_CONNECTION_POOL_HPP
+#define DBUS_CONNECTION_POOL_HPP
+
+#include <dbus/connection.hpp>
+#include <dbus/endpoint.hpp>
+#include <dbus/message.hpp>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+#include <asio.hpp>
+
+namespace dbus {
+
+/// A set of private connections to the same bus.
+/**
+ * Outgoing calls are spread across the connections of the pool, so that a
+ * client issuing many calls is not limited by the serialization and locking
+ * of a single DBusConnection. Giving each connection its own io_context lets
+ * the pool use one thread per connection.
+ *
+ * The pool only carries outgoing traffic. Filters, matches and bus names
+ * belong on a dedicated dbus::connection.
+ */
+class connection_pool {
+ public:
+  /// How a connection is chosen for an outgoing message.
+  enum class policy {
+    /// Hash the destination bus name. Messages to the same destination always
+    /// use the same connection, so they reach it in the order they were sent.
+    by_destination,
+    /// Rotate through the connections. Spreads load evenly, but messages to
+    /// the same destination may be reordered.
+    round_robin
+  };
+
+  /// Open size connections to a well-known bus, all on one io_context.
+  /**
+ * @throws asio::system_error With invalid_argument if size is 0, or when
+ * opening a connection failed.
+ */
+  connection_pool(asio::io_context& io, const int bus, std::size_t size,
+                  policy p = policy::by_destination,
+                  threading t = threading::single)
+      : policy_(p), next_(0) {
+    if (size == 0) {
+      asio::detail::throw_exception(
+          asio::system_error(asio::error::invalid_argument));
+    }
+    connections_.reserve(size);
+    while (connections_.size() < size) {
+      connections_.emplace_back(std::make_unique<connection>(io, bus, t));
+    }
+  }
+
+  /// Open one connection to a well-known bus on each of the io_contexts.
+  /**
+ * @throws asio::system_error With invalid_argument if ios is empty, or when
+ * opening a connection failed.
+ */
+  connection_pool(
+      const std::vector<std::reference_wrapper<asio::io_context>>& ios,
+      const int bus, policy p = policy::by_destination,
+      threading t = threading::single)
+      : policy_(p), next_(0) {
+    if (ios.empty()) {
+      asio::detail::throw_exception(
+          asio::system_error(asio::error::invalid_argument));
+    }
+    connections_.reserve(ios.size());
+    for (asio::io_context& io : ios) {
+      connections_.emplace_back(std::make_unique<connection>(io, bus, t));
+    }
+  }
+
+  connection_pool(const connection_pool&) = delete;
+  connection_pool& operator=(const connection_pool&) = delete;
+
+  std::size_t size() const { return connections_.size(); }
+
+  connection& operator[](std::size_t i) { return *connections_[i]; }
+
+  /// Pick the connection that will carry messages to a destination.
+  connection& select(const string& destination) {
+    if (connections_.size() == 1) {
+      return *connections_.front();
+    }
+    if (policy_ == policy::round_robin) {
+      return *connections_[next_.fetch_add(1, std::memory_order_relaxed) %
+                           connections_.size()];
+    }
+    return *connections_[std::hash<string>()(destination) %
+                         connections_.size()];
+  }
+
+  /// Send a message asynchronously on one of the pooled connections.
+  template <typename MessageHandler>
+  inline ASIO_INITFN_RESULT_TYPE(MessageHandler,
+                                 void(asio::error_code, message))
+      async_send(message& m, ASIO_MOVE_ARG(MessageHandler) handler,
+                 int timeout_ms = -1) {
+    return select(m.get_destination())
+        .async_send(m, ASIO_MOVE_CAST(MessageHandler)(handler), timeout_ms);
+  }
+
+  /// Call a method asynchronously on one of the pooled connections.
+  template <typename MessageHandler, typename... InputArgs>
+  auto async_method_call(MessageHandler handler, const dbus::endpoint& e,
+                         const InputArgs&... a) {
+    return select(e.get_process_name())
+        .async_method_call(std::move(handler), e, a...);
+  }
+
+  /// Call a method asynchronously on one of the pooled connections, with any
+  /// completion token.
+  template <typename... Results, typename... Args>
+  auto async_method_call(const dbus::endpoint& e, Args&&... args) {
+    return select(e.get_process_name())
+        .template async_method_call<Results...>(e,
+                                                std::forward<Args>(args)...);
+  }
+
+  /// Call a method on one of the pooled connections and wait for the reply.
+  template <typename... InputArgs>
+  message method_call(const dbus::endpoint& e, const InputArgs&... a) {
+    return select(e.get_process_name()).method_call(e, a...);
+  }
+
+  void flush() {
+    for (auto& c : connections_) {
+      c->flush();
+    }
+  }
+
+ private:
+  policy policy_;
+  std::atomic<std::size_t> next_;
+  std::vector<std::unique_ptr<connection>> connections_;
+};
+
+}  // namespace dbus
+
+#endif  // DBUS_CONNECTION_POOL_HPP
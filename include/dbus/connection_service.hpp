@@ -23,6 +23,17 @@ static const int system = DBUS_BUS_SYSTEM;
 static const int starter = DBUS_BUS_STARTER;
 }  // namespace bus
 
+/// How a connection schedules its internal work.
+enum class threading {
+  /// Post straight to the io_context. Only safe when the io_context is run
+  /// from a single thread.
+  single,
+  /// Serialize all watches, timeouts, dispatching and completions of the
+  /// connection on a per-connection strand, so that the io_context may be
+  /// run from a thread pool.
+  strand
+};
+
 class filter;
 class match;
 class connection;
@@ -43,16 +54,18 @@ class connection_service
     // TODO is there anything that needs shutting down?
   }
 
-  inline void open(implementation_type& impl, const string& address) {
+  inline void open(implementation_type& impl, const string& address,
+                   threading t = threading::single) {
     asio::io_context& io = this->get_io_context();
 
-    impl.open(io, address);
+    impl.open(io, address, t == threading::strand);
   }
 
-  inline void open(implementation_type& impl, const int bus = bus::system) {
+  inline void open(implementation_type& impl, const int bus = bus::system,
+                   threading t = threading::single) {
     asio::io_context& io = this->get_io_context();
 
-    impl.open(io, bus);
+    impl.open(io, bus, t == threading::strand);
   }
 
   inline message send(implementation_type& impl, message& m) {
@@ -79,14 +92,14 @@ class connection_service
       async_send(implementation_type& impl, message& m,
                  ASIO_MOVE_ARG(MessageHandler) handler, int timeout_ms) {
     // begin asynchronous operation
-    impl.start(this->get_io_context());
+    impl.start();
 
     asio::async_completion<
         MessageHandler, void(asio::error_code, message)>
         init(handler);
     detail::async_send_op<typename asio::async_result<
         MessageHandler, void(asio::error_code, message)>::completion_handler_type>(
-        this->get_io_context(), init.completion_handler)(impl, m, timeout_ms);
+        init.completion_handler)(impl, m, timeout_ms);
 
     return init.result.get();
   }
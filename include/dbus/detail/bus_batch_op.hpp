@@ -0,0 +1,222 @@
+// Copyright (c) Benjamin Kietzman (github.com/bkietz)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+#ifndef DBUS_BUS_BATCH_OP_HPP
+#define DBUS_BUS_BATCH_OP_HPP
+
+#include <dbus/dbus.h>
+#include <dbus/detail/match_registry.hpp>
+#include <dbus/detail/method_call_op.hpp>
+#include <dbus/element.hpp>
+#include <dbus/endpoint.hpp>
+#include <dbus/message.hpp>
+#include <asio/associated_executor.hpp>
+#include <asio/dispatch.hpp>
+#include <asio/io_context.hpp>
+#include <asio/post.hpp>
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace dbus {
+namespace detail {
+
+// A method of the bus daemon itself.
+inline endpoint bus_endpoint(const char* member) {
+  return endpoint(DBUS_SERVICE_DBUS, DBUS_PATH_DBUS, DBUS_INTERFACE_DBUS,
+                  member);
+}
+
+/// Build one call to a bus daemon method per element of firsts, each with
+/// that element as its first argument followed by rest.
+/**
+ * @return invalid_argument, with calls left empty, if any call could not be
+ * built.
+ */
+template <typename... Args>
+asio::error_code new_bus_calls(const char* member,
+                               const std::vector<string>& firsts,
+                               std::vector<message>& calls,
+                               const Args&... rest) {
+  calls.clear();
+  calls.reserve(firsts.size());
+  for (auto& first : firsts) {
+    calls.push_back(message::new_call(bus_endpoint(member)));
+    if (!calls.back().pack(first, rest...)) {
+      calls.clear();
+      return asio::error::invalid_argument;
+    }
+  }
+  return asio::error_code();
+}
+
+template <typename Handler>
+struct method_call_completion<Handler, void> {
+  Handler handler_;
+  asio::error_code ec_;
+  void operator()() { handler_(ec_); }
+};
+
+// Replies of a batch of calls to the bus daemon, gathered until the last
+// arrives. With a void Result the replies are only acknowledgements;
+// otherwise each carries a single Result.
+template <typename Handler, typename Result>
+class bus_batch_state {
+ public:
+  bus_batch_state(Handler h, asio::io_context::executor_type ex,
+                  std::size_t n, asio::error_code ec)
+      : handler_(std::move(h)),
+        io_executor_(ex),
+        results_(n),
+        ec_(ec),
+        remaining_(n) {}
+
+  void complete(std::size_t i, asio::error_code ec, message& r) {
+    if (!ec && !r.unpack(results_[i])) {
+      ec = asio::error::invalid_argument;
+    }
+    if (ec && !ec_) {
+      ec_ = ec;
+    }
+    if (--remaining_ == 0) {
+      finish();
+    }
+  }
+
+  void finish() {
+    auto ex = asio::get_associated_executor(handler_, io_executor_);
+    asio::dispatch(ex, method_call_completion<Handler, std::vector<Result>>{
+                           std::move(handler_), ec_, std::move(results_)});
+  }
+
+ private:
+  Handler handler_;
+  asio::io_context::executor_type io_executor_;
+  std::vector<Result> results_;
+  asio::error_code ec_;
+  std::atomic<std::size_t> remaining_;
+};
+
+template <typename Handler>
+class bus_batch_state<Handler, void> {
+ public:
+  bus_batch_state(Handler h, asio::io_context::executor_type ex,
+                  std::size_t n, asio::error_code ec)
+      : handler_(std::move(h)), io_executor_(ex), ec_(ec), remaining_(n) {}
+
+  void complete(std::size_t, asio::error_code ec, message&) { complete(ec); }
+
+  void complete(asio::error_code ec) {
+    if (ec && !ec_) {
+      ec_ = ec;
+    }
+    if (--remaining_ == 0) {
+      finish();
+    }
+  }
+
+  void finish() {
+    auto ex = asio::get_associated_executor(handler_, io_executor_);
+    asio::dispatch(ex, method_call_completion<Handler, void>{
+                           std::move(handler_), ec_});
+  }
+
+ private:
+  Handler handler_;
+  asio::io_context::executor_type io_executor_;
+  asio::error_code ec_;
+  std::atomic<std::size_t> remaining_;
+};
+
+// Initiation object for a batch of calls to the bus daemon; see
+// new_bus_calls().
+template <typename Connection, typename Result>
+struct initiate_bus_batch {
+  Connection& connection_;
+
+  template <typename Handler>
+  void operator()(Handler&& handler, std::vector<message> calls,
+                  asio::error_code ec) const {
+    typedef bus_batch_state<typename std::decay<Handler>::type, Result>
+        state_type;
+    auto state = std::make_shared<state_type>(std::forward<Handler>(handler),
+                                              connection_.get_executor(),
+                                              calls.size(), ec);
+
+    if (calls.empty()) {
+      asio::post(connection_.get_executor(), [state] { state->finish(); });
+      return;
+    }
+
+    // Every call is queued before any reply is read, so the whole batch
+    // takes a single round trip to the bus daemon.
+    for (std::size_t i = 0; i < calls.size(); ++i) {
+      connection_.async_send(calls[i],
+                             [state, i](asio::error_code ec, message r) {
+                               state->complete(i, ec, r);
+                             });
+    }
+  }
+};
+
+// Initiation object for AddMatch calls counted in a connection's
+// match_registry. Only rules without a subscriber yet are sent; for the
+// others the batch waits until the earlier AddMatch is acknowledged.
+template <typename Connection>
+struct initiate_add_matches {
+  Connection& connection_;
+  std::shared_ptr<match_registry> registry_;
+
+  template <typename Handler>
+  void operator()(Handler&& handler, std::vector<string> keys) const {
+    typedef bus_batch_state<typename std::decay<Handler>::type, void>
+        state_type;
+
+    std::vector<string> first, shared;
+    for (auto& key : keys) {
+      (registry_->acquire(key) ? first : shared).push_back(key);
+    }
+
+    std::vector<message> calls;
+    asio::error_code ec = new_bus_calls("AddMatch", first, calls);
+    if (ec) {
+      for (auto& key : first) registry_->installed(key, ec);
+    }
+
+    auto ex = connection_.get_executor();
+    auto state = std::make_shared<state_type>(std::forward<Handler>(handler),
+                                              ex, calls.size() + shared.size(),
+                                              ec);
+    if (calls.empty() && shared.empty()) {
+      asio::post(ex, [state] { state->finish(); });
+      return;
+    }
+
+    for (auto& key : shared) {
+      asio::error_code known;
+      auto waiter = [state, ex](asio::error_code ec) {
+        asio::post(ex, [state, ec] { state->complete(ec); });
+      };
+      if (!registry_->wait(key, waiter, known)) waiter(known);
+    }
+
+    std::weak_ptr<match_registry> weak = registry_;
+    for (std::size_t i = 0; i < calls.size(); ++i) {
+      connection_.async_send(
+          calls[i], [state, weak, key = std::move(first[i])](
+                        asio::error_code ec, message) {
+            if (auto registry = weak.lock()) registry->installed(key, ec);
+            state->complete(ec);
+          });
+    }
+  }
+};
+
+}  // namespace detail
+}  // namespace dbus
+
+#endif  // DBUS_BUS_BATCH_OP_HPP
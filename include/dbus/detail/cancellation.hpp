@@ -0,0 +1,96 @@
+// Copyright (c) Benjamin Kietzman (github.com/bkietz)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+#ifndef DBUS_CANCELLATION_HPP
+#define DBUS_CANCELLATION_HPP
+
+#include <asio/version.hpp>
+
+#include <type_traits>
+#include <utility>
+
+// Per-operation cancellation appeared in Asio 1.19. With older versions the
+// helpers below compile to nothing and operations are simply not cancellable.
+#if ASIO_VERSION >= 101900
+#define DBUS_HAS_CANCELLATION_SLOTS
+#include <asio/associated_cancellation_slot.hpp>
+#include <asio/bind_cancellation_slot.hpp>
+#include <asio/cancellation_signal.hpp>
+#include <asio/cancellation_type.hpp>
+#endif
+
+namespace dbus {
+namespace detail {
+
+#if defined(DBUS_HAS_CANCELLATION_SLOTS)
+
+typedef asio::cancellation_slot cancellation_slot;
+typedef asio::cancellation_type_t cancellation_type;
+
+template <typename Handler>
+cancellation_slot get_cancellation_slot(const Handler& h) {
+  return asio::get_associated_cancellation_slot(h);
+}
+
+template <typename Handler>
+auto bind_cancellation_slot(const cancellation_slot& s, Handler&& h) {
+  return asio::bind_cancellation_slot(s, std::forward<Handler>(h));
+}
+
+/// The handler wrapped by bind_cancellation_slot, whose signature is used to
+/// unpack a method reply.
+template <typename Handler>
+struct handler_target {
+  typedef Handler type;
+};
+
+template <typename Handler, typename Slot>
+struct handler_target<asio::cancellation_slot_binder<Handler, Slot>> {
+  typedef Handler type;
+};
+
+/// Whether a cancellation request asks the operation to stop.
+inline bool is_cancel_request(cancellation_type t) {
+  return (t & (asio::cancellation_type::terminal |
+               asio::cancellation_type::partial |
+               asio::cancellation_type::total)) !=
+         asio::cancellation_type::none;
+}
+
+#else
+
+struct cancellation_slot {
+  bool is_connected() const { return false; }
+  void clear() {}
+  template <typename CancellationHandler, typename... Args>
+  void emplace(Args&&...) {}
+};
+
+enum class cancellation_type { none };
+
+template <typename Handler>
+cancellation_slot get_cancellation_slot(const Handler&) {
+  return cancellation_slot();
+}
+
+template <typename Handler>
+typename std::decay<Handler>::type bind_cancellation_slot(
+    const cancellation_slot&, Handler&& h) {
+  return std::forward<Handler>(h);
+}
+
+template <typename Handler>
+struct handler_target {
+  typedef Handler type;
+};
+
+inline bool is_cancel_request(cancellation_type) { return false; }
+
+#endif
+
+}  // namespace detail
+}  // namespace dbus
+
+#endif  // DBUS_CANCELLATION_HPP
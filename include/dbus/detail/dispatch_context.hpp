@@ -0,0 +1,233 @@
+// Copyright (c) Benjamin Kietzman (github.com/bkietz)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+#ifndef DBUS_DISPATCH_CONTEXT_HPP
+#define DBUS_DISPATCH_CONTEXT_HPP
+
+#include <dbus/dbus.h>
+#include <asio/bind_executor.hpp>
+#include <asio/detail/mutex.hpp>
+#include <asio/generic/stream_protocol.hpp>
+#include <asio/io_context.hpp>
+#include <asio/strand.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <utility>
+
+namespace dbus {
+
+/// Counters describing how a connection drains its incoming messages.
+struct dispatch_stats {
+  /// Number of times the dispatcher was scheduled.
+  std::uint64_t runs = 0;
+  /// Number of messages dispatched.
+  std::uint64_t messages = 0;
+  /// Largest number of messages dispatched in a single run.
+  std::uint64_t max_batch = 0;
+  /// Runs that yielded with messages left because max_messages was reached.
+  std::uint64_t message_budget_yields = 0;
+  /// Runs that yielded with messages left because max_time was reached.
+  std::uint64_t time_budget_yields = 0;
+};
+
+namespace detail {
+
+/// Where the internal work of a single connection is scheduled.
+/**
+ * Every watch, timeout, dispatch and queue completion belonging to one
+ * DBusConnection goes through its dispatch_context. In serialized mode all of
+ * that work is funneled through a per-connection strand, so the io_context may
+ * be run from several threads without two of them ever entering libdbus (or a
+ * filter callback) for the same connection at once.
+ *
+ * The context is owned by the DBusConnection itself (see attach()), because
+ * pending handlers keep a reference to the DBusConnection and may outlive the
+ * dbus::connection object that opened it.
+ */
+class dispatch_context {
+ public:
+  typedef asio::strand<asio::io_context::executor_type> strand_type;
+  typedef asio::generic::stream_protocol::socket socket_type;
+  typedef ::asio::detail::mutex mutex_type;
+  typedef std::mutex watch_mutex_type;
+
+  dispatch_context(asio::io_context& io, bool serialized)
+      : io_(io), strand_(io.get_executor()), serialized_(serialized) {}
+
+  ~dispatch_context() {
+    // the descriptors belong to libdbus
+    asio::error_code ec;
+    for (auto& s : sockets_) s.second.first->release(ec);
+  }
+
+  dispatch_context(const dispatch_context&) = delete;
+  dispatch_context& operator=(const dispatch_context&) = delete;
+
+  asio::io_context& get_io_context() { return io_; }
+
+  strand_type& get_strand() { return strand_; }
+
+  bool is_serialized() const { return serialized_; }
+
+  /// Set how much work one dispatch run may do before yielding.
+  void set_budget(std::size_t max_messages, std::chrono::microseconds max_time) {
+    max_messages_ = max_messages ? max_messages : 1;
+    max_time_us_ = max_time.count();
+  }
+
+  std::size_t get_max_messages() const { return max_messages_; }
+
+  std::chrono::microseconds get_max_time() const {
+    return std::chrono::microseconds(max_time_us_);
+  }
+
+  /// Account for one dispatch run.
+  void record_run(std::size_t batch, bool message_yield, bool time_yield) {
+    runs_.fetch_add(1, std::memory_order_relaxed);
+    messages_.fetch_add(batch, std::memory_order_relaxed);
+    auto max = max_batch_.load(std::memory_order_relaxed);
+    while (batch > max &&
+           !max_batch_.compare_exchange_weak(max, batch,
+                                             std::memory_order_relaxed)) {
+    }
+    if (message_yield)
+      message_budget_yields_.fetch_add(1, std::memory_order_relaxed);
+    if (time_yield) time_budget_yields_.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  dispatch_stats get_stats() const {
+    dispatch_stats s;
+    s.runs = runs_.load(std::memory_order_relaxed);
+    s.messages = messages_.load(std::memory_order_relaxed);
+    s.max_batch = max_batch_.load(std::memory_order_relaxed);
+    s.message_budget_yields =
+        message_budget_yields_.load(std::memory_order_relaxed);
+    s.time_budget_yields = time_budget_yields_.load(std::memory_order_relaxed);
+    return s;
+  }
+
+  /// Schedule a handler for later execution.
+  template <typename Handler>
+  void post(Handler&& handler) {
+    if (serialized_)
+      asio::post(strand_, std::forward<Handler>(handler));
+    else
+      asio::post(io_, std::forward<Handler>(handler));
+  }
+
+  /// Start an asynchronous operation whose completion should be serialized.
+  /**
+   * @param initiation Callable accepting the (possibly strand-bound) handler
+   * and starting the operation with it.
+   */
+  template <typename Initiation, typename Handler>
+  void initiate(Initiation&& initiation, Handler&& handler) {
+    if (serialized_)
+      initiation(asio::bind_executor(strand_, std::forward<Handler>(handler)));
+    else
+      initiation(std::forward<Handler>(handler));
+  }
+
+  /// Guards the watch sockets and the state of the watches and timeouts.
+  /**
+   * libdbus calls the watch and timeout functions with its connection lock
+   * held, and they take this mutex. It must therefore never be held while
+   * calling into libdbus in a way that takes the connection lock, such as
+   * handling a watch or timeout.
+   */
+  watch_mutex_type& get_watch_mutex() { return watch_mutex_; }
+
+  /// Get the socket wrapping a descriptor, creating it for the first watch.
+  /**
+   * libdbus usually installs separate read and write watches on the same
+   * descriptor, and a descriptor can only be registered with the reactor
+   * once, so the watches share one socket. Must be called with the watch
+   * mutex held.
+   */
+  socket_type* acquire_socket(int fd, asio::error_code& ec) {
+    auto it = sockets_.find(fd);
+    if (it == sockets_.end()) {
+      std::unique_ptr<socket_type> socket(new socket_type(io_));
+      socket->assign(asio::generic::stream_protocol(0, 0), fd, ec);
+      if (ec) return nullptr;
+      it = sockets_.emplace(fd, std::make_pair(std::move(socket), 0)).first;
+    }
+    ++it->second.second;
+    return it->second.first.get();
+  }
+
+  /// Find the socket wrapping a descriptor. Must be called with the watch
+  /// mutex held.
+  socket_type* find_socket(int fd) {
+    auto it = sockets_.find(fd);
+    return it == sockets_.end() ? nullptr : it->second.first.get();
+  }
+
+  /// Drop a watch's reference to a socket. The last reference aborts any
+  /// pending operations and hands the descriptor back without closing it.
+  /// Must be called with the watch mutex held.
+  void release_socket(int fd) {
+    auto it = sockets_.find(fd);
+    if (it == sockets_.end() || --it->second.second > 0) return;
+    asio::error_code ec;
+    it->second.first->release(ec);
+    sockets_.erase(it);
+  }
+
+  /// Give ownership of a new context to a DBusConnection.
+  static dispatch_context& attach(DBusConnection* conn, asio::io_context& io,
+                                  bool serialized) {
+    auto ctx = new dispatch_context(io, serialized);
+    dbus_connection_set_data(conn, slot(), ctx, [](void* d) {
+      delete static_cast<dispatch_context*>(d);
+    });
+    return *ctx;
+  }
+
+  /// Look up the context attached to a DBusConnection.
+  static dispatch_context& get(DBusConnection* conn) {
+    return *static_cast<dispatch_context*>(
+        dbus_connection_get_data(conn, slot()));
+  }
+
+ private:
+  static dbus_int32_t slot() {
+    // the slot is process wide and never released
+    static dbus_int32_t slot_ = [] {
+      dbus_int32_t s = -1;
+      dbus_connection_allocate_data_slot(&s);
+      return s;
+    }();
+    return slot_;
+  }
+
+  asio::io_context& io_;
+  strand_type strand_;
+  bool serialized_;
+
+  watch_mutex_type watch_mutex_;
+  std::map<int, std::pair<std::unique_ptr<socket_type>, std::size_t>>
+      sockets_;
+
+  // one message per run unless configured otherwise
+  std::atomic<std::size_t> max_messages_{1};
+  std::atomic<std::chrono::microseconds::rep> max_time_us_{0};
+
+  std::atomic<std::uint64_t> runs_{0};
+  std::atomic<std::uint64_t> messages_{0};
+  std::atomic<std::uint64_t> max_batch_{0};
+  std::atomic<std::uint64_t> message_budget_yields_{0};
+  std::atomic<std::uint64_t> time_budget_yields_{0};
+};
+
+}  // namespace detail
+}  // namespace dbus
+
+#endif  // DBUS_DISPATCH_CONTEXT_HPP
@@ -0,0 +1,238 @@
+// Copyright (c) Benjamin Kietzman (github.com/bkietz)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+#ifndef DBUS_MATCH_REGISTRY_HPP
+#define DBUS_MATCH_REGISTRY_HPP
+
+#include <asio/detail/mutex.hpp>
+#include <asio/error.hpp>
+#include <asio/error_code.hpp>
+
+#include <algorithm>
+#include <cctype>
+#include <cstddef>
+#include <functional>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace dbus {
+
+/// A match rule installed on a connection, as listed for diagnostics.
+struct match_rule_info {
+  /// The rule in canonical form, as sent to the bus daemon.
+  std::string rule;
+  /// Number of match objects and match_set entries holding the rule.
+  std::size_t subscribers;
+  /// Whether the bus daemon has answered the AddMatch call.
+  bool acknowledged;
+  /// The daemon's answer, if any.
+  asio::error_code error;
+};
+
+namespace detail {
+
+/// The match rules of one connection, with a subscriber count for each.
+/**
+ * Rules are keyed by their canonical form, so equivalent expressions share
+ * one entry. Only the first subscriber installs a rule and only the last one
+ * removes it.
+ */
+class match_registry {
+ public:
+  typedef ::asio::detail::mutex mutex_type;
+  typedef std::function<void(asio::error_code)> waiter_type;
+
+  match_registry() = default;
+  match_registry(const match_registry&) = delete;
+  match_registry& operator=(const match_registry&) = delete;
+
+  ~match_registry() {
+    for (auto& r : rules_)
+      for (auto& w : r.second.waiters) w(asio::error::operation_aborted);
+  }
+
+  /// Canonical form of a match rule: keys sorted, whitespace before keys
+  /// dropped and every value quoted.
+  /**
+   * A rule that cannot be parsed is returned unchanged; the bus daemon will
+   * reject it.
+   */
+  static std::string normalize(const std::string& rule) {
+    std::vector<std::pair<std::string, std::string>> elements;
+    std::size_t i = 0, n = rule.size();
+    while (i < n) {
+      while (i < n && std::isspace(static_cast<unsigned char>(rule[i]))) ++i;
+      if (i == n) break;
+
+      std::size_t eq = rule.find('=', i);
+      if (eq == std::string::npos) return rule;
+      if (eq == i) return rule;
+      std::string key = rule.substr(i, eq - i);
+
+      // Quoted and unquoted runs may alternate; outside quotes \' stands
+      // for an apostrophe.
+      std::string value;
+      bool quoted = false;
+      for (i = eq + 1; i < n; ++i) {
+        char c = rule[i];
+        if (quoted) {
+          if (c == '\'')
+            quoted = false;
+          else
+            value += c;
+        } else if (c == '\'') {
+          quoted = true;
+        } else if (c == '\\' && i + 1 < n && rule[i + 1] == '\'') {
+          value += '\'';
+          ++i;
+        } else if (c == ',') {
+          break;
+        } else {
+          value += c;
+        }
+      }
+      if (quoted) return rule;
+      if (i < n) ++i;  // the comma
+
+      elements.emplace_back(std::move(key), std::move(value));
+    }
+
+    std::sort(elements.begin(), elements.end());
+    std::string out;
+    for (std::size_t e = 0; e < elements.size(); ++e) {
+      if (e > 0) {
+        if (elements[e].first == elements[e - 1].first) return rule;
+        out += ',';
+      }
+      out += elements[e].first;
+      out += "='";
+      for (char c : elements[e].second) {
+        if (c == '\'')
+          out += "'\\''";
+        else
+          out += c;
+      }
+      out += '\'';
+    }
+    return out;
+  }
+
+  /// Add a subscriber to a rule.
+  /**
+   * @return true for the first subscriber, which has to install the rule and
+   * report the outcome through installed().
+   */
+  bool acquire(const std::string& key) {
+    mutex_type::scoped_lock lock(mutex_);
+    return ++rules_[key].subscribers == 1;
+  }
+
+  /// Drop a subscriber from a rule.
+  /**
+   * @return The number of RemoveMatch calls the last subscriber has to send:
+   * one, plus the copies recorded by add_copy(). Zero for the others.
+   */
+  std::size_t release(const std::string& key) {
+    mutex_type::scoped_lock lock(mutex_);
+    auto it = rules_.find(key);
+    if (it == rules_.end()) return 0;
+    if (--it->second.subscribers > 0) return 0;
+    std::size_t calls = 1 + it->second.copies;
+    rules_.erase(it);
+    return calls;
+  }
+
+  /// Record that a subscriber installed its own copy of a rule, which the
+  /// bus daemon counts separately.
+  void add_copy(const std::string& key) {
+    mutex_type::scoped_lock lock(mutex_);
+    auto it = rules_.find(key);
+    if (it != rules_.end()) ++it->second.copies;
+  }
+
+  /// Whether the bus daemon has answered AddMatch for a rule.
+  /**
+   * @return true, with the daemon's answer in ec, when it has.
+   */
+  bool answered(const std::string& key, asio::error_code& ec) {
+    mutex_type::scoped_lock lock(mutex_);
+    auto it = rules_.find(key);
+    if (it == rules_.end() || !it->second.acknowledged) return false;
+    ec = it->second.error;
+    return true;
+  }
+
+  /// Record the bus daemon's answer to AddMatch and wake waiting
+  /// subscribers.
+  void installed(const std::string& key, asio::error_code ec) {
+    std::vector<waiter_type> waiters;
+    {
+      mutex_type::scoped_lock lock(mutex_);
+      auto it = rules_.find(key);
+      if (it == rules_.end()) return;
+      it->second.acknowledged = true;
+      it->second.error = ec;
+      waiters.swap(it->second.waiters);
+    }
+    for (auto& w : waiters) w(ec);
+  }
+
+  /// Wait for a rule installed by an earlier subscriber.
+  /**
+   * @return false, with the daemon's answer in ec, when the rule is already
+   * acknowledged. Otherwise w is called once it is, possibly from within
+   * installed() or the registry's destructor, so it should only post.
+   */
+  bool wait(const std::string& key, waiter_type w, asio::error_code& ec) {
+    mutex_type::scoped_lock lock(mutex_);
+    auto it = rules_.find(key);
+    if (it == rules_.end() || it->second.acknowledged) {
+      if (it != rules_.end()) ec = it->second.error;
+      return false;
+    }
+    it->second.waiters.push_back(std::move(w));
+    return true;
+  }
+
+  /// The bus daemon's answer to AddMatch for a rule; empty while it has not
+  /// answered or if nobody holds the rule.
+  asio::error_code get_error(const std::string& key) {
+    mutex_type::scoped_lock lock(mutex_);
+    auto it = rules_.find(key);
+    return it == rules_.end() ? asio::error_code() : it->second.error;
+  }
+
+  /// The installed rules, in canonical form and sorted.
+  std::vector<match_rule_info> rules() {
+    mutex_type::scoped_lock lock(mutex_);
+    std::vector<match_rule_info> out;
+    out.reserve(rules_.size());
+    for (auto& r : rules_) {
+      out.push_back(match_rule_info{r.first, r.second.subscribers,
+                                    r.second.acknowledged, r.second.error});
+    }
+    return out;
+  }
+
+ private:
+  struct entry {
+    std::size_t subscribers = 0;
+    // AddMatch calls sent in addition to the first one
+    std::size_t copies = 0;
+    bool acknowledged = false;
+    asio::error_code error;
+    std::vector<waiter_type> waiters;
+  };
+
+  mutex_type mutex_;
+  std::map<std::string, entry> rules_;
+};
+
+}  // namespace detail
+}  // namespace dbus
+
+#endif  // DBUS_MATCH_REGISTRY_HPP
@@ -0,0 +1,96 @@
+// Copyright (c) Benjamin Kietzman (github.com/bkietz)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+#ifndef DBUS_METHOD_CALL_OP_HPP
+#define DBUS_METHOD_CALL_OP_HPP
+
+#include <dbus/detail/cancellation.hpp>
+#include <dbus/message.hpp>
+#include <asio/associated_executor.hpp>
+#include <asio/dispatch.hpp>
+#include <asio/io_context.hpp>
+#include <asio/post.hpp>
+
+#include <tuple>
+#include <utility>
+
+namespace dbus {
+namespace detail {
+
+// Deliver the unpacked results of a method call on the executor associated
+// with the final handler, defaulting to the connection's io_context.
+template <typename Handler, typename Results>
+struct method_call_completion {
+  Handler handler_;
+  asio::error_code ec_;
+  Results results_;
+  void operator()() { handler_(ec_, std::move(results_)); }
+};
+
+// Results are either a std::tuple of the reply's arguments or, for replies
+// with a single argument, that argument's type.
+template <typename... Results>
+bool unpack_results(std::tuple<Results...>& results, message& r) {
+  return unpack_into_tuple(results, r);
+}
+
+template <typename Result>
+bool unpack_results(Result& result, message& r) {
+  return r.unpack(result);
+}
+
+// Intermediate handler of async_method_call: unpacks the reply into the
+// results.
+template <typename Handler, typename Results>
+struct method_call_op {
+  Handler handler_;
+  asio::io_context::executor_type io_executor_;
+
+  void operator()(asio::error_code ec, message r) {
+    Results results{};
+    if (!ec && !unpack_results(results, r)) {
+      ec = asio::error::invalid_argument;
+    }
+    auto ex = asio::get_associated_executor(handler_, io_executor_);
+    asio::dispatch(ex, method_call_completion<Handler, Results>{
+                           std::move(handler_), ec, std::move(results)});
+  }
+};
+
+// Initiation object of async_method_call, see asio::async_initiate.
+template <typename Connection, typename Results>
+struct initiate_method_call {
+  Connection& connection_;
+
+  template <typename Handler>
+  void operator()(Handler&& handler, message m, asio::error_code ec,
+                  int timeout_ms) const {
+    typedef typename std::decay<Handler>::type handler_type;
+    auto io_executor = connection_.get_executor();
+
+    if (ec) {
+      // the call could not be built; complete without sending anything
+      auto ex = asio::get_associated_executor(handler, io_executor);
+      asio::post(ex, method_call_completion<handler_type, Results>{
+                         std::forward<Handler>(handler), ec, Results()});
+      return;
+    }
+
+    // the final handler's cancellation slot stays reachable by the pending
+    // call table
+    cancellation_slot slot = get_cancellation_slot(handler);
+    connection_.async_send(
+        m,
+        detail::bind_cancellation_slot(
+            slot, method_call_op<handler_type, Results>{
+                      std::forward<Handler>(handler), io_executor}),
+        timeout_ms);
+  }
+};
+
+}  // namespace detail
+}  // namespace dbus
+
+#endif  // DBUS_METHOD_CALL_OP_HPP
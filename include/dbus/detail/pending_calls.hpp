@@ -0,0 +1,444 @@
+// Copyright (c) Benjamin Kietzman (github.com/bkietz)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+#ifndef DBUS_PENDING_CALLS_HPP
+#define DBUS_PENDING_CALLS_HPP
+
+#include <dbus/dbus.h>
+#include <dbus/detail/cancellation.hpp>
+#include <dbus/detail/dispatch_context.hpp>
+#include <dbus/error.hpp>
+#include <dbus/message.hpp>
+#include <asio/detail/mutex.hpp>
+#include <asio/steady_timer.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace dbus {
+namespace detail {
+
+// Completion handler of a pending call, with its type erased.
+struct reply_handler_base {
+  // Post the handler with the reply and release it.
+  virtual void complete(dispatch_context& ctx, asio::error_code ec,
+                        message m) = 0;
+  // Release the handler without calling it.
+  virtual void destroy() = 0;
+
+ protected:
+  ~reply_handler_base() {}
+};
+
+template <typename Handler>
+struct reply_completion {
+  Handler handler_;
+  asio::error_code ec_;
+  message message_;
+  void operator()() {
+    // the operation is over, whichever way it ended
+    get_cancellation_slot(handler_).clear();
+    handler_(ec_, message_);
+  }
+};
+
+template <typename Handler, bool Inline>
+struct reply_handler final : reply_handler_base {
+  Handler handler_;
+
+  explicit reply_handler(Handler&& h) : handler_(std::move(h)) {}
+
+  void complete(dispatch_context& ctx, asio::error_code ec,
+                message m) override {
+    reply_completion<Handler> c{std::move(handler_), ec, std::move(m)};
+    destroy();
+    ctx.post(std::move(c));
+  }
+
+  void destroy() override {
+    if (Inline)
+      this->~reply_handler();
+    else
+      delete this;
+  }
+};
+
+/// Outstanding method calls of one connection, keyed by serial.
+/**
+ * Replies are picked up by a single connection filter, and timeouts are
+ * driven by a single timer, so an asynchronous call needs neither a
+ * DBusPendingCall nor a heap allocated operation. Handlers small enough to
+ * fit a slot are stored in place, and slots, index and timeout heap are
+ * recycled, so once they have grown to the number of outstanding calls the
+ * call path does not allocate.
+ *
+ * The serial is recorded while the table is locked, so a reply cannot be
+ * dispatched by another thread before its handler is in place.
+ */
+class pending_calls : public std::enable_shared_from_this<pending_calls> {
+ public:
+  typedef ::asio::detail::mutex mutex_type;
+  typedef std::chrono::steady_clock clock_type;
+
+  // libdbus' own default for DBUS_TIMEOUT_USE_DEFAULT
+  static constexpr int default_timeout_ms = 25000;
+
+  explicit pending_calls(dispatch_context& ctx)
+      : ctx_(ctx),
+        timer_(ctx.get_io_context()),
+        armed_(clock_type::time_point::max()),
+        used_(0),
+        aborted_(false) {
+    index_.resize(64);
+  }
+
+  pending_calls(const pending_calls&) = delete;
+  pending_calls& operator=(const pending_calls&) = delete;
+
+  ~pending_calls() {
+    for (auto& e : index_) {
+      if (e.serial != 0) {
+        slots_[e.slot].handler->destroy();
+      }
+    }
+  }
+
+  /// Send a method call and register a handler for its reply.
+  /**
+   * @param timeout_ms Time to wait for the reply. -1 selects the libdbus
+   * default, DBUS_TIMEOUT_INFINITE waits forever.
+   */
+  template <typename Handler>
+  void send(DBusConnection* conn, DBusMessage* m, int timeout_ms,
+            Handler&& handler) {
+    typedef typename std::decay<Handler>::type handler_type;
+    typedef reply_handler<handler_type, true> inline_type;
+    typedef reply_handler<handler_type, false> heap_type;
+
+    mutex_type::scoped_lock lock(mutex_);
+
+    if (aborted_) {
+      lock.unlock();
+      ctx_.post(reply_completion<handler_type>{
+          std::forward<Handler>(handler), asio::error::operation_aborted,
+          message()});
+      return;
+    }
+
+    cancellation_slot cs = get_cancellation_slot(handler);
+    std::uint32_t s = allocate_slot();
+    slot& sl = slots_[s];
+    if constexpr (sizeof(inline_type) <= sizeof(slot_storage) &&
+                  alignof(inline_type) <= alignof(slot_storage)) {
+      sl.handler = new (&sl.storage) inline_type(std::forward<Handler>(handler));
+    } else {
+      sl.handler = new heap_type(std::forward<Handler>(handler));
+    }
+
+    dbus_uint32_t serial = 0;
+    if (!dbus_connection_send(conn, m, &serial)) {
+      reply_handler_base* h = sl.handler;
+      free_slot(s);
+      h->complete(ctx_, asio::error::no_memory, message());
+      return;
+    }
+
+    insert(serial, s);
+
+    if (cs.is_connected()) {
+      cs.template emplace<canceller>(weak_from_this(), serial, s,
+                                     sl.generation);
+    }
+
+    if (timeout_ms == DBUS_TIMEOUT_INFINITE) {
+      return;
+    }
+    if (timeout_ms < 0) {
+      timeout_ms = default_timeout_ms;
+    }
+
+    compact_timeouts();
+    auto deadline = clock_type::now() + std::chrono::milliseconds(timeout_ms);
+    timeouts_.push_back({deadline, serial, s, sl.generation});
+    std::push_heap(timeouts_.begin(), timeouts_.end(), later);
+    if (deadline < armed_) {
+      arm(deadline);
+    }
+  }
+
+  /// Connection filter routing replies to their handlers.
+  static DBusHandlerResult filter(DBusConnection* c, DBusMessage* m,
+                                  void* userdata) {
+    int type = dbus_message_get_type(m);
+    if (type != DBUS_MESSAGE_TYPE_METHOD_RETURN &&
+        type != DBUS_MESSAGE_TYPE_ERROR) {
+      return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+    }
+
+    auto& self = **static_cast<std::shared_ptr<pending_calls>*>(userdata);
+    return self.complete(dbus_message_get_reply_serial(m), m)
+               ? DBUS_HANDLER_RESULT_HANDLED
+               : DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+  }
+
+  /// Complete one outstanding call with operation_aborted.
+  /**
+   * Nothing is sent to the peer; a reply arriving later is not matched and
+   * passes on to the connection's other filters.
+   */
+  void cancel(dbus_uint32_t serial, std::uint32_t s, std::uint32_t generation) {
+    mutex_type::scoped_lock lock(mutex_);
+    if (slots_[s].generation != generation) {
+      return;  // already completed
+    }
+    reply_handler_base* h = slots_[s].handler;
+    erase(find(serial));
+    free_slot(s);
+    h->complete(ctx_, asio::error::operation_aborted, message());
+  }
+
+  /// Complete every outstanding call with operation_aborted.
+  void abort() {
+    mutex_type::scoped_lock lock(mutex_);
+    aborted_ = true;
+    for (auto& e : index_) {
+      if (e.serial != 0) {
+        reply_handler_base* h = slots_[e.slot].handler;
+        free_slot(e.slot);
+        e.serial = 0;
+        h->complete(ctx_, asio::error::operation_aborted, message());
+      }
+    }
+    used_ = 0;
+    timeouts_.clear();
+    armed_ = clock_type::time_point::max();
+    timer_.cancel();
+  }
+
+  /// Number of calls waiting for a reply.
+  std::size_t size() {
+    mutex_type::scoped_lock lock(mutex_);
+    return used_;
+  }
+
+ private:
+  // Installed in the cancellation slot of a call's completion handler.
+  struct canceller {
+    std::weak_ptr<pending_calls> calls;
+    dbus_uint32_t serial;
+    std::uint32_t slot;
+    std::uint32_t generation;
+
+    canceller(std::weak_ptr<pending_calls> c, dbus_uint32_t se,
+              std::uint32_t sl, std::uint32_t g)
+        : calls(std::move(c)), serial(se), slot(sl), generation(g) {}
+
+    void operator()(cancellation_type type) {
+      if (!is_cancel_request(type)) return;
+      if (auto self = calls.lock()) self->cancel(serial, slot, generation);
+    }
+  };
+
+  typedef std::aligned_storage<8 * sizeof(void*), alignof(std::max_align_t)>::type
+      slot_storage;
+
+  struct slot {
+    std::uint32_t generation = 0;
+    std::uint32_t next_free = 0;
+    reply_handler_base* handler = nullptr;
+    slot_storage storage;
+  };
+
+  struct index_entry {
+    dbus_uint32_t serial;  // 0 marks an empty entry
+    std::uint32_t slot;
+  };
+
+  struct timeout_entry {
+    clock_type::time_point deadline;
+    dbus_uint32_t serial;
+    std::uint32_t slot;
+    std::uint32_t generation;
+  };
+
+  static bool later(const timeout_entry& a, const timeout_entry& b) {
+    return a.deadline > b.deadline;
+  }
+
+  static const std::uint32_t no_slot = std::numeric_limits<std::uint32_t>::max();
+
+  std::uint32_t allocate_slot() {
+    if (free_ == no_slot) {
+      slots_.emplace_back();
+      return static_cast<std::uint32_t>(slots_.size() - 1);
+    }
+    std::uint32_t s = free_;
+    free_ = slots_[s].next_free;
+    return s;
+  }
+
+  void free_slot(std::uint32_t s) {
+    slot& sl = slots_[s];
+    sl.handler = nullptr;
+    ++sl.generation;
+    sl.next_free = free_;
+    free_ = s;
+  }
+
+  std::size_t mask() const { return index_.size() - 1; }
+
+  // Linear probing over a power of two sized table; serials are handed out
+  // sequentially, so the low bits spread well enough on their own.
+  std::size_t find(dbus_uint32_t serial) const {
+    for (std::size_t i = serial & mask();; i = (i + 1) & mask()) {
+      if (index_[i].serial == serial) return i;
+      if (index_[i].serial == 0) return index_.size();
+    }
+  }
+
+  void insert(dbus_uint32_t serial, std::uint32_t s) {
+    if ((used_ + 1) * 2 > index_.size()) {
+      std::vector<index_entry> old(index_.size() * 2, index_entry{0, 0});
+      old.swap(index_);
+      for (auto& e : old) {
+        if (e.serial != 0) place(e);
+      }
+    }
+    place(index_entry{serial, s});
+    ++used_;
+  }
+
+  void place(index_entry e) {
+    std::size_t i = e.serial & mask();
+    while (index_[i].serial != 0) i = (i + 1) & mask();
+    index_[i] = e;
+  }
+
+  // Backward shift deletion keeps probe sequences intact without tombstones.
+  void erase(std::size_t i) {
+    std::size_t j = i;
+    for (;;) {
+      j = (j + 1) & mask();
+      if (index_[j].serial == 0) break;
+      std::size_t home = index_[j].serial & mask();
+      if ((j > i && (home <= i || home > j)) ||
+          (j < i && (home <= i && home > j))) {
+        index_[i] = index_[j];
+        i = j;
+      }
+    }
+    index_[i].serial = 0;
+    --used_;
+  }
+
+  bool complete(dbus_uint32_t serial, DBusMessage* m) {
+    mutex_type::scoped_lock lock(mutex_);
+    std::size_t i = find(serial);
+    if (i == index_.size()) {
+      return false;
+    }
+    std::uint32_t s = index_[i].slot;
+    reply_handler_base* h = slots_[s].handler;
+    erase(i);
+    free_slot(s);
+
+    message reply(m);
+    h->complete(ctx_, error(reply).error_code(), reply);
+    return true;
+  }
+
+  // Drop timeout entries of calls that already completed once they make up
+  // most of the heap.
+  void compact_timeouts() {
+    if (timeouts_.size() < 64 || timeouts_.size() < 2 * used_) {
+      return;
+    }
+    timeouts_.erase(std::remove_if(timeouts_.begin(), timeouts_.end(),
+                                   [this](const timeout_entry& t) {
+                                     return slots_[t.slot].generation !=
+                                            t.generation;
+                                   }),
+                    timeouts_.end());
+    std::make_heap(timeouts_.begin(), timeouts_.end(), later);
+  }
+
+  void arm(clock_type::time_point deadline) {
+    armed_ = deadline;
+    timer_.expires_at(deadline);
+    std::weak_ptr<pending_calls> weak = shared_from_this();
+    ctx_.initiate([this](auto&& h) { timer_.async_wait(std::move(h)); },
+                  [weak](const asio::error_code& ec) {
+                    if (ec) return;
+                    if (auto self = weak.lock()) self->expire();
+                  });
+  }
+
+  void expire() {
+    mutex_type::scoped_lock lock(mutex_);
+    armed_ = clock_type::time_point::max();
+    auto now = clock_type::now();
+    while (!timeouts_.empty() && timeouts_.front().deadline <= now) {
+      timeout_entry t = timeouts_.front();
+      std::pop_heap(timeouts_.begin(), timeouts_.end(), later);
+      timeouts_.pop_back();
+      if (slots_[t.slot].generation != t.generation) {
+        continue;  // already completed
+      }
+      std::size_t i = find(t.serial);
+      reply_handler_base* h = slots_[t.slot].handler;
+      erase(i);
+      free_slot(t.slot);
+
+      message reply = timeout_error(t.serial);
+      h->complete(ctx_, error(reply).error_code(), reply);
+    }
+    if (!timeouts_.empty()) {
+      arm(timeouts_.front().deadline);
+    }
+  }
+
+  // The same error libdbus synthesizes when a DBusPendingCall times out.
+  static message timeout_error(dbus_uint32_t serial) {
+    DBusMessage* m = dbus_message_new(DBUS_MESSAGE_TYPE_ERROR);
+    dbus_message_set_error_name(m, DBUS_ERROR_NO_REPLY);
+    dbus_message_set_reply_serial(m, serial);
+    dbus_message_set_no_reply(m, TRUE);
+    const char* text =
+        "Did not receive a reply. Possible causes include: the remote "
+        "application did not send a reply, the message bus security policy "
+        "blocked the reply, the reply timeout expired, or the network "
+        "connection was broken.";
+    dbus_message_append_args(m, DBUS_TYPE_STRING, &text, DBUS_TYPE_INVALID);
+    message reply(m);
+    dbus_message_unref(m);
+    return reply;
+  }
+
+  dispatch_context& ctx_;
+  mutex_type mutex_;
+  asio::steady_timer timer_;
+  clock_type::time_point armed_;
+
+  std::deque<slot> slots_;
+  std::uint32_t free_ = no_slot;
+  std::vector<index_entry> index_;
+  std::size_t used_;
+  std::vector<timeout_entry> timeouts_;
+  bool aborted_;
+};
+
+}  // namespace detail
+}  // namespace dbus
+
+#endif  // DBUS_PENDING_CALLS_HPP
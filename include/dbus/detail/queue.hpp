@@ -6,14 +6,68 @@
 #ifndef DBUS_QUEUE_HPP
 #define DBUS_QUEUE_HPP
 
+#include <dbus/detail/cancellation.hpp>
+#include <dbus/detail/dispatch_context.hpp>
+#include <dbus/message.hpp>
+#include <cstddef>
+#include <cstdint>
 #include <deque>
 #include <functional>
+#include <limits>
+#include <memory>
+#include <utility>
 #include <asio.hpp>
 #include <asio/detail/mutex.hpp>
 
 namespace dbus {
+
+/// What to do with a message arriving at a full buffer.
+enum class overflow_policy {
+  /// Discard the oldest buffered message.
+  drop_oldest,
+  /// Discard the arriving message.
+  drop_newest,
+  /// Replace the newest buffered message with the same path, interface and
+  /// member, or else discard the oldest.
+  coalesce,
+  /// Discard the arriving message, and complete the next wait with
+  /// asio::error::no_buffer_space before any buffered message.
+  report
+};
+
+/// Counters describing the buffer of a filter.
+struct queue_stats {
+  /// Messages buffered now.
+  std::size_t buffered = 0;
+  /// Most messages ever buffered at once.
+  std::size_t high_water_mark = 0;
+  /// Messages discarded because the buffer was full.
+  std::uint64_t dropped = 0;
+  /// Buffered messages replaced by a newer one under overflow_policy::coalesce.
+  std::uint64_t coalesced = 0;
+};
+
 namespace detail {
 
+// Whether two buffered messages may stand for each other.
+inline bool same_origin(const message& a, const message& b) {
+  return a.get_member_view() == b.get_member_view() &&
+         a.get_interface_view() == b.get_interface_view() &&
+         a.get_path_view() == b.get_path_view();
+}
+
+template <typename Message>
+bool same_origin(const Message&, const Message&) {
+  return false;
+}
+
+/// Messages waiting for handlers, or handlers waiting for messages.
+/**
+ * A message is handed to the handler that has been waiting longest, or else
+ * buffered until the next async_pop. A subscriber instead takes the buffered
+ * messages one after another. The buffer is unbounded unless a limit is set,
+ * in which case an overflow_policy decides what is discarded.
+ */
 template <typename Message>
 class queue {
  public:
@@ -21,45 +75,271 @@ class queue {
   typedef Message message_type;
   typedef std::function<void(asio::error_code, Message)> handler_type;
 
+  /// A handler called with every message, installed once.
+  class subscriber {
+   public:
+    explicit subscriber(handler_type h) : handler_(std::move(h)) {}
+
+   private:
+    friend class queue;
+
+    handler_type handler_;
+    // The queue delivering to the subscriber, cleared once it stops
+    mutex_type mutex_;
+    queue* q_ = nullptr;
+    // Whether a pump is posted or running; guarded by the queue's mutex
+    bool scheduled_ = false;
+  };
+
  private:
-  asio::io_context& io;
-  mutex_type mutex;
+  // A handler waiting for a message
+  struct waiter {
+    std::uint64_t id;
+    handler_type handler;
+    cancellation_slot slot;
+  };
+
+  // The queue, for as long as it exists. A completion may be posted, and
+  // the queue destroyed, before the handler's slot is cleared.
+  struct anchor {
+    mutex_type mutex;
+    queue* q;
+    explicit anchor(queue* qu) : q(qu) {}
+  };
+
+  // Installed in the cancellation slot of a waiting handler
+  struct canceller {
+    std::shared_ptr<anchor> a;
+    std::uint64_t id;
+    canceller(std::shared_ptr<anchor> an, std::uint64_t i)
+        : a(std::move(an)), id(i) {}
+    void operator()(cancellation_type type) {
+      if (!is_cancel_request(type)) return;
+      mutex_type::scoped_lock lock(a->mutex);
+      if (a->q != nullptr) a->q->cancel(id);
+    }
+  };
+
+  dispatch_context& ctx;
+  std::shared_ptr<anchor> self;
+  mutable mutex_type mutex;
   std::deque<message_type> messages;
-  std::deque<handler_type> handlers;
+  std::deque<waiter> handlers;
+  std::shared_ptr<subscriber> current;
+  std::uint64_t next_id = 0;
+
+  std::size_t limit = std::numeric_limits<std::size_t>::max();
+  overflow_policy policy = overflow_policy::drop_oldest;
+  bool overflowed = false;
+  queue_stats stats;
 
  public:
-  queue(asio::io_context& io_ctx) : io(io_ctx) {}
+  queue(dispatch_context& c) : ctx(c), self(std::make_shared<anchor>(this)) {}
 
-  queue(const queue<Message>& m)
-      : io(m.io), messages(m.messages), handlers(m.handlers) {
-    // TODO(ed) acquire the lock before copying messages and handlers
+  queue(const queue&) = delete;
+  queue& operator=(const queue&) = delete;
+
+  ~queue() {
+    {
+      mutex_type::scoped_lock lock(self->mutex);
+      self->q = nullptr;
+    }
+    if (current) {
+      mutex_type::scoped_lock lock(current->mutex_);
+      current->q_ = nullptr;
+    }
+    // waiting handlers are dropped along with their cancellers
+    for (auto& w : handlers) w.slot.clear();
   }
 
  private:
+  // Hands the buffered messages to a subscriber, one per run, so that they
+  // stay buffered, and subject to the limit, until the subscriber catches
+  // up.
+  struct pump {
+    std::shared_ptr<subscriber> s;
+    void operator()() {
+      message_type m;
+      asio::error_code ec;
+      {
+        mutex_type::scoped_lock lock(s->mutex_);
+        if (s->q_ == nullptr || !s->q_->take(m, ec)) return;
+      }
+      s->handler_(ec, m);
+      mutex_type::scoped_lock lock(s->mutex_);
+      if (s->q_ != nullptr) s->q_->reschedule(s);
+    }
+  };
+
+  // Post a pump for the subscriber unless one is pending. Must be called
+  // with the mutex held.
+  void schedule() {
+    if (current->scheduled_) return;
+    current->scheduled_ = true;
+    ctx.post(pump{current});
+  }
+
+  // The next message or error for the subscriber, if any.
+  bool take(message_type& m, asio::error_code& ec) {
+    mutex_type::scoped_lock lock(mutex);
+    if (overflowed) {
+      overflowed = false;
+      ec = asio::error::no_buffer_space;
+      return true;
+    }
+    if (messages.empty()) {
+      current->scheduled_ = false;
+      return false;
+    }
+    m = std::move(messages.front());
+    messages.pop_front();
+    set_buffered();
+    return true;
+  }
+
+  void reschedule(const std::shared_ptr<subscriber>& s) {
+    mutex_type::scoped_lock lock(mutex);
+    if (messages.empty() && !overflowed)
+      s->scheduled_ = false;
+    else
+      ctx.post(pump{s});
+  }
+
   class closure {
     handler_type handler_;
     message_type message_;
     asio::error_code error_;
+    cancellation_slot slot_;
 
    public:
-    void operator()() { handler_(error_, message_); }
+    void operator()() {
+      slot_.clear();
+      handler_(error_, message_);
+    }
     closure(handler_type h, Message m,
-            asio::error_code e = asio::error_code())
-        : handler_(h), message_(m), error_(e) {}
+            asio::error_code e = asio::error_code(),
+            cancellation_slot s = cancellation_slot())
+        : handler_(std::move(h)),
+          message_(std::move(m)),
+          error_(e),
+          slot_(s) {}
   };
 
+  // Apply the overflow policy to a message arriving at a full buffer;
+  // false if the message is not to be buffered.
+  bool make_room(message_type& m) {
+    switch (policy) {
+      case overflow_policy::drop_newest:
+        ++stats.dropped;
+        return false;
+      case overflow_policy::report:
+        ++stats.dropped;
+        overflowed = true;
+        return false;
+      case overflow_policy::coalesce:
+        for (auto it = messages.rbegin(); it != messages.rend(); ++it) {
+          if (same_origin(*it, m)) {
+            *it = std::move(m);
+            ++stats.coalesced;
+            return false;
+          }
+        }
+        break;
+      case overflow_policy::drop_oldest:
+        break;
+    }
+    // the limit may have been lowered since the last push
+    while (!messages.empty() && messages.size() >= limit) {
+      messages.pop_front();
+      ++stats.dropped;
+    }
+    return true;
+  }
+
+  void set_buffered() {
+    stats.buffered = messages.size();
+    if (stats.buffered > stats.high_water_mark) {
+      stats.high_water_mark = stats.buffered;
+    }
+  }
+
+  // Complete a waiting handler with operation_aborted.
+  void cancel(std::uint64_t id) {
+    mutex_type::scoped_lock lock(mutex);
+    for (auto it = handlers.begin(); it != handlers.end(); ++it) {
+      if (it->id == id) {
+        waiter w = std::move(*it);
+        handlers.erase(it);
+
+        lock.unlock();
+
+        ctx.post(closure(std::move(w.handler), message_type(),
+                         asio::error::operation_aborted, w.slot));
+        return;
+      }
+    }
+  }
+
  public:
+  /// Bound the number of buffered messages.
+  /**
+   * @param max_messages At least one message is always kept.
+   */
+  void set_limit(std::size_t max_messages, overflow_policy p) {
+    mutex_type::scoped_lock lock(mutex);
+    policy = p;
+    limit = max_messages == 0 ? 1 : max_messages;
+  }
+
+  /// Hand every message to a subscriber from now on, starting with those
+  /// buffered; a null subscriber leaves them for async_pop again.
+  /**
+   * Waiting handlers get nothing while a subscriber is installed. The
+   * previous subscriber is not called again once this returns, unless it is
+   * running already.
+   */
+  void subscribe(std::shared_ptr<subscriber> s) {
+    std::shared_ptr<subscriber> old;
+    {
+      mutex_type::scoped_lock lock(mutex);
+      old = current;
+    }
+    if (old) {
+      mutex_type::scoped_lock lock(old->mutex_);
+      old->q_ = nullptr;
+    }
+    if (s) {
+      mutex_type::scoped_lock lock(s->mutex_);
+      s->q_ = this;
+    }
+    mutex_type::scoped_lock lock(mutex);
+    current = std::move(s);
+    if (current && (overflowed || !messages.empty())) schedule();
+  }
+
+  queue_stats get_stats() const {
+    mutex_type::scoped_lock lock(mutex);
+    return stats;
+  }
+
   void push(message_type m) {
     mutex_type::scoped_lock lock(mutex);
-    if (handlers.empty())
-      messages.push_back(m);
-    else {
-      handler_type h = handlers.front();
+    if (current || handlers.empty()) {
+      if (messages.size() >= limit && !make_room(m)) {
+        if (current && overflowed) schedule();
+        return;
+      }
+      messages.push_back(std::move(m));
+      set_buffered();
+      if (current) schedule();
+    } else {
+      waiter w = std::move(handlers.front());
       handlers.pop_front();
 
       lock.unlock();
 
-      asio::post(io, closure(h, m));
+      ctx.post(closure(std::move(w.handler), std::move(m), asio::error_code(),
+                       w.slot));
     }
   }
 
@@ -72,28 +352,35 @@ class queue {
         MessageHandler, void(asio::error_code, message_type)>
         init_type;
 
-    mutex_type::scoped_lock lock(mutex);
-    if (messages.empty()) {
-      init_type init(h);
+    init_type init(h);
+    cancellation_slot slot = get_cancellation_slot(init.completion_handler);
 
-      handlers.push_back(init.completion_handler);
+    mutex_type::scoped_lock lock(mutex);
+    if (overflowed && !current) {
+      overflowed = false;
 
       lock.unlock();
 
-      return init.result.get();
-
+      ctx.post(closure(std::move(init.completion_handler), message_type(),
+                       asio::error::no_buffer_space));
+    } else if (messages.empty() || current) {
+      std::uint64_t id = next_id++;
+      handlers.push_back(
+          waiter{id, std::move(init.completion_handler), slot});
+      if (slot.is_connected()) {
+        slot.template emplace<canceller>(self, id);
+      }
     } else {
-      message_type m = messages.front();
+      message_type m = std::move(messages.front());
       messages.pop_front();
+      set_buffered();
 
       lock.unlock();
 
-      init_type init(h);
-
-      asio::post(io, closure(init.completion_handler, m));
-
-      return init.result.get();
+      ctx.post(closure(std::move(init.completion_handler), std::move(m)));
     }
+
+    return init.result.get();
   }
 };
 
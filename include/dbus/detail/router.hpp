@@ -0,0 +1,256 @@
+// Copyright (c) Benjamin Kietzman (github.com/bkietz)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+#ifndef DBUS_ROUTER_HPP
+#define DBUS_ROUTER_HPP
+
+#include <dbus/dbus.h>
+#include <dbus/detail/queue.hpp>
+#include <dbus/message.hpp>
+#include <asio/detail/mutex.hpp>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace dbus {
+
+/// The message headers a filter subscribes to.
+/**
+ * Fields left empty (or message_type::invalid) match anything. Unlike an
+ * arbitrary predicate, a route is looked up by hashing the headers of each
+ * message, so the cost of dispatching does not grow with the number of
+ * filters.
+ */
+struct route {
+  message_type type = message_type::invalid;
+  std::string interface;
+  std::string member;
+  /// An exact object path.
+  std::string path;
+  /// An object path and every path below it; ignored if path is set.
+  std::string path_namespace;
+
+  bool matches(const message& m) const {
+    if (type != message_type::invalid && m.get_message_type() != type)
+      return false;
+    if (!interface.empty() && m.get_interface_view() != interface)
+      return false;
+    if (!member.empty() && m.get_member_view() != member) return false;
+    std::string_view p = m.get_path_view();
+    if (!path.empty()) return p == path;
+    if (path_namespace.empty() || path_namespace == "/") return true;
+    std::size_t n = path_namespace.size();
+    return p.size() >= n && p.compare(0, n, path_namespace) == 0 &&
+           (p.size() == n || p[n] == '/');
+  }
+};
+
+namespace detail {
+
+/// Routes the incoming messages of one connection to the filters' queues.
+/**
+ * A single libdbus filter stands in for every dbus::filter of the
+ * connection. Routes are kept in a hash table, with one probe per
+ * combination of fields in use; predicates are tried one after another.
+ * Either way, a message goes to the earliest registered subscriber that
+ * accepts it, as it did when each filter was a libdbus filter of its own.
+ *
+ * Predicates run with the router locked, so they must not create or destroy
+ * filters.
+ */
+class router {
+ public:
+  typedef ::asio::detail::mutex mutex_type;
+
+  /// A subscriber, owned by its filter.
+  struct entry {
+    route r;
+    /// Used instead of the route if set.
+    std::function<bool(message&)> predicate;
+    queue<message>* target = nullptr;
+    /// Called instead of pushing to target if set.
+    std::function<void(message&)> deliver;
+    std::uint64_t order = 0;
+    /// Which fields of the route are set; see pattern_of.
+    unsigned pattern = 0;
+  };
+
+  router() = default;
+  router(const router&) = delete;
+  router& operator=(const router&) = delete;
+
+  void add(entry& e) {
+    mutex_type::scoped_lock lock(mutex_);
+    e.order = next_order_++;
+    if (e.predicate) {
+      predicates_.push_back(&e);
+      return;
+    }
+    unsigned p = pattern_of(e.r);
+    e.pattern = p;
+    routes_[hash(p, e.r)].push_back(&e);
+    ++patterns_[p];
+  }
+
+  void remove(entry& e) {
+    mutex_type::scoped_lock lock(mutex_);
+    if (e.predicate) {
+      predicates_.erase(std::find(predicates_.begin(), predicates_.end(), &e));
+      return;
+    }
+    unsigned p = e.pattern;
+    auto bucket = routes_.find(hash(p, e.r));
+    auto& v = bucket->second;
+    v.erase(std::find(v.begin(), v.end(), &e));
+    if (v.empty()) routes_.erase(bucket);
+    --patterns_[p];
+  }
+
+  /// The subscriber a message would be delivered to, if any.
+  entry* find(message& m) {
+    mutex_type::scoped_lock lock(mutex_);
+    return find_locked(m);
+  }
+
+  /// Deliver a message to its subscriber.
+  bool offer(message& m) {
+    mutex_type::scoped_lock lock(mutex_);
+    entry* e = find_locked(m);
+    if (e == nullptr) return false;
+    if (e->deliver)
+      e->deliver(m);
+    else
+      e->target->push(m);
+    return true;
+  }
+
+  static DBusHandlerResult filter(DBusConnection* c, DBusMessage* m,
+                                  void* userdata) {
+#if !defined(ASIO_NO_EXCEPTIONS)
+    try {
+#endif  // !defined(ASIO_NO_EXCEPTIONS)
+      auto& self = **static_cast<std::shared_ptr<router>*>(userdata);
+      message m_(m);
+      if (self.offer(m_)) {
+        return DBUS_HANDLER_RESULT_HANDLED;
+      }
+#if !defined(ASIO_NO_EXCEPTIONS)
+    } catch (...) {
+      // do not throw in C callbacks. Just don't.
+    }
+#endif  // !defined(ASIO_NO_EXCEPTIONS)
+
+    return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+  }
+
+ private:
+  // Which fields of a route are set.
+  enum : unsigned {
+    by_type = 1,
+    by_interface = 2,
+    by_member = 4,
+    by_path = 8,
+    by_path_namespace = 16,
+    pattern_count = 32
+  };
+
+  static unsigned pattern_of(const route& r) {
+    unsigned p = 0;
+    if (r.type != message_type::invalid) p |= by_type;
+    if (!r.interface.empty()) p |= by_interface;
+    if (!r.member.empty()) p |= by_member;
+    if (!r.path.empty())
+      p |= by_path;
+    else if (!r.path_namespace.empty() && r.path_namespace != "/")
+      p |= by_path_namespace;
+    return p;
+  }
+
+  static std::size_t hash(unsigned p, message_type type,
+                          std::string_view interface, std::string_view member,
+                          std::string_view path) {
+    std::hash<std::string_view> h;
+    std::size_t seed = p;
+    auto mix = [&seed](std::size_t v) {
+      seed ^= v + 0x9e3779b9 + (seed << 6) + (seed >> 2);
+    };
+    if (p & by_type) mix(static_cast<std::size_t>(type));
+    if (p & by_interface) mix(h(interface));
+    if (p & by_member) mix(h(member));
+    if (p & (by_path | by_path_namespace)) mix(h(path));
+    return seed;
+  }
+
+  static std::size_t hash(unsigned p, const route& r) {
+    return hash(p, r.type, r.interface, r.member,
+                (p & by_path) ? r.path : r.path_namespace);
+  }
+
+  // Look for a subscriber of pattern p that is earlier than best.
+  void probe(unsigned p, message_type type, std::string_view interface,
+             std::string_view member, std::string_view path, entry*& best) {
+    auto bucket = routes_.find(hash(p, type, interface, member, path));
+    if (bucket == routes_.end()) return;
+    // buckets are in registration order
+    for (entry* e : bucket->second) {
+      if (best != nullptr && e->order > best->order) return;
+      // a bucket may hold routes of other patterns whose hashes collide
+      if (e->pattern != p) continue;
+      const route& r = e->r;
+      if ((p & by_type) && r.type != type) continue;
+      if ((p & by_interface) && r.interface != interface) continue;
+      if ((p & by_member) && r.member != member) continue;
+      if ((p & by_path) && r.path != path) continue;
+      if ((p & by_path_namespace) && r.path_namespace != path) continue;
+      best = e;
+      return;
+    }
+  }
+
+  entry* find_locked(message& m) {
+    entry* best = nullptr;
+    if (!routes_.empty()) {
+      message_type type = m.get_message_type();
+      std::string_view interface = m.get_interface_view();
+      std::string_view member = m.get_member_view();
+      std::string_view path = m.get_path_view();
+      for (unsigned p = 0; p < pattern_count; ++p) {
+        if (patterns_[p] == 0) continue;
+        if (p & by_path_namespace) {
+          // every ancestor of the path, excluding the root
+          for (std::string_view a = path; a.size() > 1;
+               a = a.substr(0, a.rfind('/'))) {
+            probe(p, type, interface, member, a, best);
+          }
+        } else {
+          probe(p, type, interface, member, path, best);
+        }
+      }
+    }
+    for (entry* e : predicates_) {
+      if (best != nullptr && e->order > best->order) break;
+      if (e->predicate(m)) return e;
+    }
+    return best;
+  }
+
+  mutex_type mutex_;
+  std::unordered_map<std::size_t, std::vector<entry*>> routes_;
+  std::size_t patterns_[pattern_count] = {};
+  std::vector<entry*> predicates_;
+  std::uint64_t next_order_ = 0;
+};
+
+}  // namespace detail
+}  // namespace dbus
+
+#endif  // DBUS_ROUTER_HPP
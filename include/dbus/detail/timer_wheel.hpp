@@ -0,0 +1,299 @@
+// Copyright (c) Benjamin Kietzman (github.com/bkietz)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+#ifndef DBUS_TIMER_WHEEL_HPP
+#define DBUS_TIMER_WHEEL_HPP
+
+#include <dbus/detail/dispatch_context.hpp>
+#include <asio/detail/mutex.hpp>
+#include <asio/steady_timer.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <memory>
+
+namespace dbus {
+namespace detail {
+
+/// Hierarchical timer wheel with millisecond ticks.
+/**
+ * All timers of a connection share one wheel, and the wheel is driven by a
+ * single steady_timer armed for the next tick with work to do. Entries are
+ * intrusive, so scheduling, rescheduling and removing a timer neither
+ * allocates nor touches asio's timer queue.
+ *
+ * Four levels of 64 slots cover about 4.6 hours; longer delays are parked in
+ * the last level and cascaded again until they come into range.
+ *
+ * Callbacks are run from the connection's dispatch_context, without the
+ * wheel's lock held, so they may add or remove entries (including their
+ * own). An entry that may be freed from another thread while it expires
+ * names its owner with set_owner(); the owner is kept alive until the
+ * callback returns, and the entry is skipped if the owner is already gone.
+ */
+class timer_wheel : public std::enable_shared_from_this<timer_wheel> {
+ public:
+  typedef ::asio::detail::mutex mutex_type;
+  typedef std::chrono::steady_clock clock_type;
+  typedef std::chrono::milliseconds tick_duration;
+
+  static constexpr unsigned slot_bits = 6;
+  static constexpr unsigned slots = 1u << slot_bits;
+  static constexpr unsigned levels = 4;
+
+  /// A timer linked into the wheel.
+  class entry {
+   public:
+    typedef void (*callback_type)(entry&);
+
+    explicit entry(callback_type cb) : callback_(cb) {}
+
+    entry(const entry&) = delete;
+    entry& operator=(const entry&) = delete;
+
+    bool is_linked() const { return pprev_ != nullptr; }
+
+    /// Keep an owner alive while the entry's callback runs.
+    /**
+     * Must be called before the entry is first added.
+     */
+    void set_owner(std::weak_ptr<void> owner) {
+      owner_ = std::move(owner);
+      owned_ = true;
+    }
+
+   private:
+    friend class timer_wheel;
+
+    void unlink() {
+      *pprev_ = next_;
+      if (next_) next_->pprev_ = pprev_;
+      next_ = nullptr;
+      pprev_ = nullptr;
+    }
+
+    void link(entry*& head) {
+      next_ = head;
+      if (next_) next_->pprev_ = &next_;
+      head = this;
+      pprev_ = &head;
+    }
+
+    callback_type callback_;
+    std::weak_ptr<void> owner_;
+    bool owned_ = false;
+    entry* next_ = nullptr;
+    entry** pprev_ = nullptr;
+    std::uint64_t expiry_ = 0;
+    // index into the flattened slots, or due_slot
+    unsigned slot_ = 0;
+  };
+
+  explicit timer_wheel(dispatch_context& ctx)
+      : ctx_(ctx),
+        timer_(ctx.get_io_context()),
+        start_(clock_type::now()),
+        current_(0),
+        armed_(never),
+        size_(0),
+        due_(nullptr) {
+    for (auto& level : slots_) std::fill(level, level + slots, nullptr);
+    std::fill(occupied_, occupied_ + levels, 0);
+  }
+
+  timer_wheel(const timer_wheel&) = delete;
+  timer_wheel& operator=(const timer_wheel&) = delete;
+
+  ~timer_wheel() {
+    // entries are owned elsewhere; just make sure none points back here
+    for (auto& level : slots_)
+      for (auto& head : level)
+        while (head) head->unlink();
+    while (due_) due_->unlink();
+  }
+
+  /// Run an entry's callback once the delay has elapsed. An entry that is
+  /// already scheduled is moved.
+  void add(entry& e, clock_type::duration delay) {
+    auto ms = std::chrono::ceil<tick_duration>(
+        clock_type::now() - start_ +
+        std::max(delay, clock_type::duration::zero()));
+    mutex_type::scoped_lock lock(mutex_);
+    if (e.is_linked()) unlink(e);
+    e.expiry_ = static_cast<std::uint64_t>(ms.count());
+    insert(e);
+    schedule(e.expiry_);
+  }
+
+  /// Cancel an entry. Does nothing if the entry is not scheduled.
+  void remove(entry& e) {
+    mutex_type::scoped_lock lock(mutex_);
+    if (e.is_linked()) unlink(e);
+  }
+
+  dispatch_context& get_context() { return ctx_; }
+
+  /// Number of scheduled entries.
+  std::size_t size() {
+    mutex_type::scoped_lock lock(mutex_);
+    return size_;
+  }
+
+ private:
+  static constexpr unsigned due_slot = levels * slots;
+
+  static constexpr std::uint64_t never =
+      std::numeric_limits<std::uint64_t>::max();
+
+  // Longest delay a level can hold before parking in the one above
+  static constexpr std::uint64_t span(unsigned level) {
+    return std::uint64_t(1) << (slot_bits * (level + 1));
+  }
+
+  void unlink(entry& e) {
+    e.unlink();
+    if (e.slot_ == due_slot) return;
+    --size_;
+    unsigned level = e.slot_ / slots, s = e.slot_ % slots;
+    if (slots_[level][s] == nullptr)
+      occupied_[level] &= ~(std::uint64_t(1) << s);
+  }
+
+  // Put an entry into the level and slot matching its distance from now.
+  void insert(entry& e) {
+    if (e.expiry_ <= current_) {
+      e.link(due_);
+      e.slot_ = due_slot;
+      return;
+    }
+    std::uint64_t delta = e.expiry_ - current_;
+    unsigned level = 0;
+    while (level + 1 < levels && delta >= span(level)) ++level;
+    std::uint64_t when = e.expiry_;
+    if (delta >= span(levels - 1)) when = current_ + span(levels - 1) - 1;
+    unsigned s = (when >> (slot_bits * level)) & (slots - 1);
+    e.link(slots_[level][s]);
+    e.slot_ = level * slots + s;
+    occupied_[level] |= std::uint64_t(1) << s;
+    ++size_;
+  }
+
+  // The next tick at which some slot has to be expired or cascaded.
+  std::uint64_t next_event() const {
+    std::uint64_t best = never;
+    for (unsigned level = 0; level < levels; ++level) {
+      std::uint64_t bits = occupied_[level];
+      if (bits == 0) continue;
+      unsigned shift = slot_bits * level;
+      std::uint64_t block = (current_ >> shift) + 1;
+      unsigned from = block & (slots - 1);
+      std::uint64_t rotated = from ? (bits >> from) | (bits << (slots - from))
+                                   : bits;
+      block += ctz(rotated);
+      best = std::min(best, block << shift);
+    }
+    return best;
+  }
+
+  static unsigned ctz(std::uint64_t v) {
+#if defined(__GNUC__)
+    return __builtin_ctzll(v);
+#else
+    unsigned n = 0;
+    while (!(v & 1)) {
+      v >>= 1;
+      ++n;
+    }
+    return n;
+#endif
+  }
+
+  // Move everything up to tick now onto the due list.
+  void advance(std::uint64_t now) {
+    while (size_ > 0) {
+      std::uint64_t tick = next_event();
+      if (tick > now) break;
+      current_ = tick;
+      for (unsigned level = levels - 1; level > 0; --level) {
+        unsigned shift = slot_bits * level;
+        if ((tick & ((std::uint64_t(1) << shift) - 1)) == 0)
+          requeue(level, (tick >> shift) & (slots - 1));
+      }
+      requeue(0, tick & (slots - 1));
+    }
+    current_ = std::max(current_, now);
+  }
+
+  // Take every entry out of a slot and insert it again relative to now,
+  // which moves it down a level or onto the due list.
+  void requeue(unsigned level, unsigned s) {
+    entry* e = slots_[level][s];
+    if (e == nullptr) return;
+    slots_[level][s] = nullptr;
+    occupied_[level] &= ~(std::uint64_t(1) << s);
+    while (e != nullptr) {
+      entry* next = e->next_;
+      e->next_ = nullptr;
+      e->pprev_ = nullptr;
+      --size_;
+      insert(*e);
+      e = next;
+    }
+  }
+
+  // Arm the timer for a tick, unless it will already fire by then.
+  void schedule(std::uint64_t tick) {
+    if (tick >= armed_) return;
+    armed_ = tick;
+    timer_.expires_at(start_ + tick_duration(tick));
+    std::weak_ptr<timer_wheel> weak = shared_from_this();
+    ctx_.initiate([this](auto&& h) { timer_.async_wait(std::move(h)); },
+                  [weak](const asio::error_code& ec) {
+                    if (ec) return;
+                    if (auto self = weak.lock()) self->expire();
+                  });
+  }
+
+  void expire() {
+    auto now = std::chrono::duration_cast<tick_duration>(clock_type::now() -
+                                                         start_);
+    mutex_type::scoped_lock lock(mutex_);
+    armed_ = never;
+    advance(static_cast<std::uint64_t>(now.count()));
+    while (due_ != nullptr) {
+      entry& e = *due_;
+      e.unlink();
+      // an entry whose owner is gone is being destroyed, waiting for the
+      // lock to remove itself
+      std::shared_ptr<void> owner;
+      if (e.owned_ && !(owner = e.owner_.lock())) continue;
+      lock.unlock();
+      e.callback_(e);
+      // the last reference may destroy the entry, which takes the lock
+      owner.reset();
+      lock.lock();
+    }
+    if (size_ > 0) schedule(next_event());
+  }
+
+  dispatch_context& ctx_;
+  mutex_type mutex_;
+  asio::steady_timer timer_;
+  clock_type::time_point start_;
+  std::uint64_t current_;
+  std::uint64_t armed_;
+  std::size_t size_;
+  entry* due_;
+  entry* slots_[levels][slots];
+  std::uint64_t occupied_[levels];
+};
+
+}  // namespace detail
+}  // namespace dbus
+
+#endif  // DBUS_TIMER_WHEEL_HPP
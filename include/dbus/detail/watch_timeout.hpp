@@ -7,56 +7,109 @@
 #define DBUS_WATCH_TIMEOUT_HPP
 
 #include <dbus/dbus.h>
+#include <dbus/detail/dispatch_context.hpp>
+#include <dbus/detail/timer_wheel.hpp>
 #include <asio/generic/stream_protocol.hpp>
 #include <asio/io_context.hpp>
-#include <asio/steady_timer.hpp>
 
 #include <chrono>
 #include <memory>
+#include <mutex>
 
 namespace dbus {
 namespace detail {
 
-static void watch_toggled(DBusWatch *dbus_watch, void *data);
+// Bookkeeping for one DBusWatch. Completion handlers keep it alive, so they
+// can tell that libdbus removed the watch while an operation was pending.
+// Guarded by the context's watch mutex.
+struct watch_state {
+  DBusWatch *dbus_watch;
+  int fd;
+  dispatch_context &ctx;
+  bool removed = false;
+  bool read_armed = false;
+  bool write_armed = false;
+
+  watch_state(DBusWatch *w, int f, dispatch_context &c)
+      : dbus_watch(w), fd(f), ctx(c) {}
+};
+
+static void arm_watch(const std::shared_ptr<watch_state> &state);
+
 struct watch_handler {
+  std::shared_ptr<watch_state> state;
   DBusWatchFlags flags;
-  DBusWatch *dbus_watch;
-  void *data;
-  watch_handler(DBusWatchFlags f, DBusWatch *w, void *d) : flags(f), dbus_watch(w), data(d) {}
+  watch_handler(std::shared_ptr<watch_state> s, DBusWatchFlags f)
+      : state(std::move(s)), flags(f) {}
   void operator()(asio::error_code ec, size_t) {
-    if (ec) return;
-    dbus_watch_handle(dbus_watch, flags);
-    watch_toggled(dbus_watch, data);
+    {
+      std::lock_guard<dispatch_context::watch_mutex_type> lock(
+          state->ctx.get_watch_mutex());
+      (flags == DBUS_WATCH_READABLE ? state->read_armed
+                                    : state->write_armed) = false;
+      if (ec || state->removed) return;
+      // a watch disabled while the operation was pending is not handled;
+      // it will be armed again once libdbus enables it
+      if (!dbus_watch_get_enabled(state->dbus_watch)) return;
+    }
+    // Handling takes the connection lock, which libdbus holds while it calls
+    // the watch functions, so the watch mutex must not be held here.
+    dbus_watch_handle(state->dbus_watch, flags);
+    arm_watch(state);
   }
 };
-static void watch_toggled(DBusWatch *dbus_watch, void *data) {
-  void *watch_data = dbus_watch_get_data(dbus_watch);
-  if (watch_data == nullptr) {
-    return;
+
+// Wait for the descriptor to become ready in every direction the watch is
+// enabled for, unless such a wait is already pending.
+static void arm_watch(const std::shared_ptr<watch_state> &state) {
+  dispatch_context &ctx = state->ctx;
+  std::lock_guard<dispatch_context::watch_mutex_type> lock(
+      ctx.get_watch_mutex());
+  if (state->removed || !dbus_watch_get_enabled(state->dbus_watch)) return;
+
+  auto socket = ctx.find_socket(state->fd);
+  if (socket == nullptr) return;
+
+  unsigned int flags = dbus_watch_get_flags(state->dbus_watch);
+  if ((flags & DBUS_WATCH_READABLE) && !state->read_armed) {
+    state->read_armed = true;
+    ctx.initiate(
+        [socket](auto &&h) {
+          socket->async_read_some(asio::null_buffers(), std::move(h));
+        },
+        watch_handler(state, DBUS_WATCH_READABLE));
   }
 
-  auto socket =
-      static_cast<asio::generic::stream_protocol::socket *>(watch_data);
-  if (dbus_watch_get_enabled(dbus_watch)) {
-    if (dbus_watch_get_flags(dbus_watch) & DBUS_WATCH_READABLE)
-      socket->async_read_some(asio::null_buffers(),
-                              watch_handler(DBUS_WATCH_READABLE, dbus_watch, data));
+  if ((flags & DBUS_WATCH_WRITABLE) && !state->write_armed) {
+    state->write_armed = true;
+    ctx.initiate(
+        [socket](auto &&h) {
+          socket->async_write_some(asio::null_buffers(), std::move(h));
+        },
+        watch_handler(state, DBUS_WATCH_WRITABLE));
+  }
+}
 
-    if (dbus_watch_get_flags(dbus_watch) & DBUS_WATCH_WRITABLE)
-      socket->async_write_some(asio::null_buffers(),
-                               watch_handler(DBUS_WATCH_WRITABLE, dbus_watch, data));
+// Arm a watch from a libdbus callback, which may run on any thread and with
+// the connection lock held. The arming is always posted, so the sockets are
+// only touched from the io_context (and on the strand in serialized mode).
+static void schedule_arm_watch(const std::shared_ptr<watch_state> &state) {
+  state->ctx.post([state] { arm_watch(state); });
+}
 
-  } else {
-    socket->cancel();
+static void watch_toggled(DBusWatch *dbus_watch, void *data) {
+  auto holder =
+      static_cast<std::shared_ptr<watch_state> *>(dbus_watch_get_data(dbus_watch));
+  if (holder == nullptr) {
+    return;
   }
+  // Disabling needs no action: a pending wait completes without handling
+  // the watch and is not renewed.
+  schedule_arm_watch(*holder);
 }
 
 static dbus_bool_t add_watch(DBusWatch *dbus_watch, void *data) {
-  if (!dbus_watch_get_enabled(dbus_watch)) {
-    return TRUE;
-  }
-
-  asio::io_context &io = *static_cast<asio::io_context *>(data);
+  dispatch_context &ctx = *static_cast<dispatch_context *>(data);
 
   int fd = dbus_watch_get_unix_fd(dbus_watch);
 
@@ -64,126 +117,198 @@ static dbus_bool_t add_watch(DBusWatch *dbus_watch, void *data) {
     // socket based watches
     fd = dbus_watch_get_socket(dbus_watch);
 
-  auto socket = new asio::generic::stream_protocol::socket(io);
-
-  socket->assign(asio::generic::stream_protocol(0, 0), fd);
+  {
+    std::lock_guard<dispatch_context::watch_mutex_type> lock(
+        ctx.get_watch_mutex());
+    asio::error_code ec;
+    if (ctx.acquire_socket(fd, ec) == nullptr) return FALSE;
+  }
 
-  dbus_watch_set_data(dbus_watch, socket, NULL);
+  // Watches are tracked even while disabled; libdbus adds its write watch
+  // disabled and only enables it once outgoing data is queued.
+  auto state = std::make_shared<watch_state>(dbus_watch, fd, ctx);
+  dbus_watch_set_data(dbus_watch, new std::shared_ptr<watch_state>(state),
+                      [](void *d) {
+                        delete static_cast<std::shared_ptr<watch_state> *>(d);
+                      });
 
-  watch_toggled(dbus_watch, &io);
+  schedule_arm_watch(state);
   return TRUE;
 }
 
 static void remove_watch(DBusWatch *dbus_watch, void *data) {
-  delete static_cast<asio::generic::stream_protocol::socket *>(
-      dbus_watch_get_data(dbus_watch));
-}
+  auto holder =
+      static_cast<std::shared_ptr<watch_state> *>(dbus_watch_get_data(dbus_watch));
+  if (holder == nullptr) {
+    return;
+  }
+
+  {
+    auto &state = **holder;
+    std::lock_guard<dispatch_context::watch_mutex_type> lock(
+        state.ctx.get_watch_mutex());
+    state.removed = true;
+    state.ctx.release_socket(state.fd);
+  }
 
-struct timeout_handler : std::enable_shared_from_this<timeout_handler> {
-  using ptr = std::shared_ptr<timeout_handler>;
+  dbus_watch_set_data(dbus_watch, NULL, NULL);
+}
 
-  asio::steady_timer timer;
+// A DBusTimeout scheduled on the connection's timer wheel. The entry keeps
+// the wheel alive, since libdbus may release a timeout after the connection's
+// timeout functions. libdbus owns the entry through a shared_ptr, and the
+// wheel keeps it alive while it expires; `removed` is guarded by the
+// context's watch mutex.
+struct timeout_entry : timer_wheel::entry {
+  std::shared_ptr<timer_wheel> wheel;
   DBusTimeout *dbus_timeout;
-  size_t serial = 0;
+  bool removed = false;
 
-  timeout_handler(asio::io_context& io, DBusTimeout *t)
-    : timer{io}
-    , dbus_timeout(t)
-  { }
+  timeout_entry(std::shared_ptr<timer_wheel> w, DBusTimeout *t)
+      : timer_wheel::entry(&expired), wheel(std::move(w)), dbus_timeout(t) {}
 
-  void arm(asio::steady_timer::duration const& interval) {
-    disarm();
-    timer.expires_after(interval);
-    timer.async_wait([this, id = serial, self = shared_from_this()] (asio::error_code const& ec)
-        {
-          if (ec || serial != id) return;
-          dbus_timeout_handle(dbus_timeout);
-        }
-    );
+  ~timeout_entry() { wheel->remove(*this); }
+
+  void arm() {
+    wheel->add(*this, std::chrono::milliseconds(
+                          dbus_timeout_get_interval(dbus_timeout)));
   }
 
-  void disarm() {
-    serial += 1;
-    timer.cancel();
+  static void expired(timer_wheel::entry &e) {
+    auto &self = static_cast<timeout_entry &>(e);
+    {
+      std::lock_guard<dispatch_context::watch_mutex_type> lock(
+          self.wheel->get_context().get_watch_mutex());
+      if (self.removed) return;
+      // libdbus timeouts repeat until they are disabled or removed, which
+      // handling them commonly does
+      self.arm();
+    }
+    // handling takes the connection lock; see watch_handler
+    dbus_timeout_handle(self.dbus_timeout);
   }
 };
 
 static void timeout_toggled(DBusTimeout *dbus_timeout, void *data) {
-  auto& handler = *static_cast<timeout_handler::ptr *>(
+  auto holder = static_cast<std::shared_ptr<timeout_entry> *>(
       dbus_timeout_get_data(dbus_timeout));
+  if (holder == nullptr) {
+    return;
+  }
 
+  auto &entry = **holder;
   if (dbus_timeout_get_enabled(dbus_timeout)) {
-    handler->arm(std::chrono::milliseconds(dbus_timeout_get_interval(dbus_timeout)));
+    entry.arm();
   } else {
-    handler->disarm();
+    entry.wheel->remove(entry);
   }
 }
 
 static dbus_bool_t add_timeout(DBusTimeout *dbus_timeout, void *data) {
-  if (!dbus_timeout_get_enabled(dbus_timeout)) return TRUE;
-
-  asio::io_context &io = *static_cast<asio::io_context *>(data);
+  auto &wheel = *static_cast<std::shared_ptr<timer_wheel> *>(data);
 
-  auto handler = new timeout_handler::ptr(std::make_shared<timeout_handler>(io, dbus_timeout));
-
-  dbus_timeout_set_data(dbus_timeout, handler,
-      [] (void *d) { delete static_cast<timeout_handler::ptr *>(d); });
+  // Disabled timeouts are tracked too, so that enabling them later works.
+  auto entry = std::make_shared<timeout_entry>(wheel, dbus_timeout);
+  entry->set_owner(entry);
+  dbus_timeout_set_data(
+      dbus_timeout, new std::shared_ptr<timeout_entry>(std::move(entry)),
+      [](void *d) { delete static_cast<std::shared_ptr<timeout_entry> *>(d); });
 
   timeout_toggled(dbus_timeout, data);
   return TRUE;
 }
 
 static void remove_timeout(DBusTimeout *dbus_timeout, void *data) {
-  auto& handler = *static_cast<timeout_handler::ptr *>(
+  auto holder = static_cast<std::shared_ptr<timeout_entry> *>(
       dbus_timeout_get_data(dbus_timeout));
-  handler->disarm();
+  if (holder == nullptr) {
+    return;
+  }
+  // libdbus may free the timeout once this returns; an expiry running on
+  // another thread sees the flag and leaves it alone
+  auto &entry = **holder;
+  std::lock_guard<dispatch_context::watch_mutex_type> lock(
+      entry.wheel->get_context().get_watch_mutex());
+  entry.removed = true;
+  entry.wheel->remove(entry);
 }
 
 class dispatch_handler {
-  asio::io_context &io;
+  dispatch_context &ctx;
   DBusConnection *conn;
-  dispatch_handler(asio::io_context &i, DBusConnection *c)
-      : io(i), conn(c) {
+  dispatch_handler(dispatch_context &c, DBusConnection *dc)
+      : ctx(c), conn(dc) {
     dbus_connection_ref(conn);
   }
 public:
   ~dispatch_handler() {
     dbus_connection_unref(conn);
   }
-  dispatch_handler(const dispatch_handler& other) : io{other.io} , conn{other.conn} {
+  dispatch_handler(const dispatch_handler& other) : ctx{other.ctx} , conn{other.conn} {
     dbus_connection_ref(conn);
   }
-  dispatch_handler(dispatch_handler&& other) : io{other.io} , conn{other.conn} {
+  dispatch_handler(dispatch_handler&& other) : ctx{other.ctx} , conn{other.conn} {
     dbus_connection_ref(conn);
   }
   dispatch_handler& operator=(const dispatch_handler&) = delete;
   dispatch_handler& operator=(dispatch_handler&&) = delete;
   void operator()() {
-    if (dbus_connection_dispatch(conn) == DBUS_DISPATCH_DATA_REMAINS)
-      process(io, conn);
+    // Drain up to the configured budget before giving the rest of the
+    // io_context a chance to run.
+    const std::size_t max_messages = ctx.get_max_messages();
+    const auto max_time = ctx.get_max_time();
+    const bool timed = max_time.count() > 0;
+    const auto started = timed ? std::chrono::steady_clock::now()
+                               : std::chrono::steady_clock::time_point();
+
+    std::size_t batch = 0;
+    bool out_of_time = false;
+    DBusDispatchStatus status;
+    do {
+      status = dbus_connection_dispatch(conn);
+      ++batch;
+      if (timed && status == DBUS_DISPATCH_DATA_REMAINS)
+        out_of_time = std::chrono::steady_clock::now() - started >= max_time;
+    } while (status == DBUS_DISPATCH_DATA_REMAINS && batch < max_messages &&
+             !out_of_time);
+
+    const bool remains = status == DBUS_DISPATCH_DATA_REMAINS;
+    ctx.record_run(batch, remains && !out_of_time, remains && out_of_time);
+
+    if (remains)
+      process(ctx, conn);
   }
-  static void process(asio::io_context &io, DBusConnection* conn) {
-    asio::post(io, dispatch_handler(io, conn));
+  static void process(dispatch_context &ctx, DBusConnection* conn) {
+    ctx.post(dispatch_handler(ctx, conn));
   }
 };
 
 static void dispatch_status(DBusConnection *conn, DBusDispatchStatus new_status,
                             void *data) {
-  asio::io_context &io = *static_cast<asio::io_context *>(data);
+  dispatch_context &ctx = *static_cast<dispatch_context *>(data);
   if (new_status == DBUS_DISPATCH_DATA_REMAINS)
-    dispatch_handler::process(io, conn);
+    dispatch_handler::process(ctx, conn);
 }
 
-static void set_watch_timeout_dispatch_functions(DBusConnection *conn,
-                                                 asio::io_context &io) {
+static dispatch_context &set_watch_timeout_dispatch_functions(
+    DBusConnection *conn, asio::io_context &io, bool serialized) {
+  // The context is released together with the DBusConnection, after libdbus
+  // has removed the last watch and timeout that could still refer to it.
+  dispatch_context &ctx = dispatch_context::attach(conn, io, serialized);
+
   dbus_connection_set_watch_functions(conn, &add_watch, &remove_watch,
-                                      &watch_toggled, &io, NULL);
+                                      &watch_toggled, &ctx, NULL);
 
-  dbus_connection_set_timeout_functions(conn, &add_timeout, &remove_timeout,
-                                        &timeout_toggled, &io, NULL);
+  // All timeouts of the connection share one wheel, released by libdbus
+  // once the connection is finalized.
+  dbus_connection_set_timeout_functions(
+      conn, &add_timeout, &remove_timeout, &timeout_toggled,
+      new std::shared_ptr<timer_wheel>(std::make_shared<timer_wheel>(ctx)),
+      [](void *d) { delete static_cast<std::shared_ptr<timer_wheel> *>(d); });
 
-  dbus_connection_set_dispatch_status_function(conn, &dispatch_status, &io,
+  dbus_connection_set_dispatch_status_function(conn, &dispatch_status, &ctx,
                                                NULL);
+  return ctx;
 }
 
 }  // namespace detail
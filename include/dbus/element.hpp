@@ -11,8 +11,13 @@
 #include <cstdint>
 #include <optional>
 #include <string>
+#include <string_view>
+#include <tuple>
 #include <variant>
 #include <vector>
+#if __cplusplus > 201703L && __has_include(<span>)
+#include <span>
+#endif
 
 namespace dbus {
 
@@ -50,6 +55,46 @@ struct signature {
   string value;
 };
 
+/// Object path borrowed from a message; see array_view.
+struct object_path_view {
+  std::string_view value;
+  bool operator<(const object_path_view& b) const { return value < b.value; }
+};
+/// Signature borrowed from a message; see array_view.
+struct signature_view {
+  std::string_view value;
+};
+
+/// Read-only view of an array of fixed type elements.
+/**
+ * Unpacking into an array_view borrows the elements straight from the
+ * message buffer, so the view is only valid while the message it was
+ * unpacked from is alive. It can be packed like any other container.
+ */
+template <typename T>
+class array_view {
+ public:
+  typedef T value_type;
+  typedef const T* const_iterator;
+  typedef const T* iterator;
+
+  array_view() : data_(nullptr), size_(0) {}
+  array_view(const T* data, std::size_t size) : data_(data), size_(size) {}
+
+  const T* data() const { return data_; }
+  std::size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+
+  const T& operator[](std::size_t i) const { return data_[i]; }
+
+  const_iterator begin() const { return data_; }
+  const_iterator end() const { return data_ + size_; }
+
+ private:
+  const T* data_;
+  std::size_t size_;
+};
+
 /**
  * D-Bus Message elements are identified by unique integer type codes.
  */
@@ -124,11 +169,33 @@ struct element<signature> {
   static constexpr int code = DBUS_TYPE_SIGNATURE;
 };
 
+template <>
+struct element<std::string_view> {
+  static constexpr int code = DBUS_TYPE_STRING;
+};
+
+template <>
+struct element<object_path_view> {
+  static constexpr int code = DBUS_TYPE_OBJECT_PATH;
+};
+
+template <>
+struct element<signature_view> {
+  static constexpr int code = DBUS_TYPE_SIGNATURE;
+};
+
 template <typename Element>
 struct element<std::vector<Element>> {
   static constexpr int code = DBUS_TYPE_ARRAY;
 };
 
+// Tuples are marshalled as structs
+template <typename... Elements>
+struct element<std::tuple<Elements...>> {
+  static_assert(sizeof...(Elements) > 0, "D-Bus has no empty structs");
+  static constexpr int code = DBUS_TYPE_STRUCT;
+};
+
 template <typename T>
 struct is_fixed_type
   : std::integral_constant<
@@ -150,9 +217,40 @@ struct is_string_type
     bool,
     std::is_same<string, std::remove_cv_t<T>>::value ||
     std::is_same<object_path, std::remove_cv_t<T>>::value ||
-    std::is_same<signature, std::remove_cv_t<T>>::value
+    std::is_same<signature, std::remove_cv_t<T>>::value ||
+    std::is_same<std::string_view, std::remove_cv_t<T>>::value ||
+    std::is_same<object_path_view, std::remove_cv_t<T>>::value ||
+    std::is_same<signature_view, std::remove_cv_t<T>>::value
   > {};
 
+// Contiguous containers of fixed types other than bool, whose memory is laid
+// out exactly as D-Bus marshals an array of them. These are packed with a
+// single append_fixed_array call. bool is excluded because D-Bus stores it
+// in four bytes.
+template <typename T>
+struct is_fixed_array_element
+  : std::integral_constant<
+    bool,
+    is_fixed_type<T>::value && !std::is_same<bool, std::remove_cv_t<T>>::value
+  > {};
+
+template <typename Container>
+struct is_fixed_array : std::false_type {};
+
+template <typename T, typename Allocator>
+struct is_fixed_array<std::vector<T, Allocator>> : is_fixed_array_element<T> {};
+
+template <typename T, std::size_t N>
+struct is_fixed_array<std::array<T, N>> : is_fixed_array_element<T> {};
+
+template <typename T>
+struct is_fixed_array<array_view<T>> : is_fixed_array_element<T> {};
+
+#if defined(__cpp_lib_span)
+template <typename T, std::size_t Extent>
+struct is_fixed_array<std::span<T, Extent>> : is_fixed_array_element<T> {};
+#endif
+
 template <std::size_t... Is>
 struct seq {};
 
@@ -247,6 +345,38 @@ struct element_signature<std::pair<Key, Value>> {
                            std::array<char, 2>{{'}', 0}})));
 };
 
+template <typename Element, typename = void>
+struct has_element_signature : std::false_type {};
+
+template <typename Element>
+struct has_element_signature<
+    Element, std::void_t<decltype(element_signature<Element>::code)>>
+    : std::true_type {};
+
+// Signature of a whole message body whose arguments are of the given types,
+// for example "sa{sv}" for a string followed by a map of variants.
+template <typename... Elements>
+struct args_signature {
+  static auto constexpr code = std::array<char, 1>{{0}};
+};
+
+template <typename First, typename... Rest>
+struct args_signature<First, Rest...> {
+  static auto constexpr code =
+      concat(element_signature<std::decay_t<First>>::code,
+             args_signature<Rest...>::code);
+};
+
+// Specialization for std::tuple, a struct of its elements, for example (sdt)
+template <typename... Elements>
+struct element_signature<std::tuple<Elements...>> {
+  static_assert(sizeof...(Elements) > 0, "D-Bus has no empty structs");
+  static auto const constexpr code =
+      concat(std::array<char, 2>{{'(', 0}},
+             concat(args_signature<Elements...>::code,
+                    std::array<char, 2>{{')', 0}}));
+};
+
 }  // namespace dbus
 
 #endif  // DBUS_ELEMENT_HPP
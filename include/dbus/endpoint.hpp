@@ -8,6 +8,7 @@
 
 #include <dbus/dbus.h>
 #include <dbus/element.hpp>
+#include <ostream>
 
 namespace dbus {
 
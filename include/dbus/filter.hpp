@@ -8,43 +8,136 @@
 
 #include <dbus/connection.hpp>
 #include <dbus/detail/queue.hpp>
+#include <dbus/detail/router.hpp>
 #include <dbus/message.hpp>
 #include <functional>
+#include <memory>
+#include <type_traits>
+#include <utility>
 #include <asio.hpp>
 
 namespace dbus {
 
 /// Represents a filter of incoming messages.
 /**
- * Filters examine incoming messages, demuxing them to multiple queues.
+ * Filters examine incoming messages, demuxing them to multiple queues. A
+ * message goes to the first filter, in order of construction, that accepts
+ * it. Filters on a route are found by hash lookup; filters with an arbitrary
+ * predicate are tried one by one.
  */
 class filter {
+  friend class connection_service;
+
   connection& connection_;
-  std::function<bool(message&)> predicate_;
   detail::queue<message> queue_;
+  detail::router::entry entry_;
+  std::shared_ptr<detail::queue<message>::subscriber> subscriber_;
 
  public:
   bool offer(message& m) {
-    bool filtered = predicate_(m);
+    bool filtered = entry_.predicate ? entry_.predicate(m)
+                                     : entry_.r.matches(m);
     if (filtered) queue_.push(m);
     return filtered;
   }
 
-  template <typename MessagePredicate>
+  template <typename MessagePredicate,
+            typename = typename std::enable_if<
+                !std::is_same<typename std::decay<MessagePredicate>::type,
+                              route>::value>::type>
   filter(connection& c, ASIO_MOVE_ARG(MessagePredicate) p)
       : connection_(c),
-        predicate_(ASIO_MOVE_CAST(MessagePredicate)(p)),
-        queue_(connection_.get_executor().context()) {
+        queue_(connection_.get_implementation().get_dispatch_context()) {
+    entry_.predicate = ASIO_MOVE_CAST(MessagePredicate)(p);
+    entry_.target = &queue_;
+    connection_.new_filter(*this);
+  }
+
+  /// Accept the messages matching a route.
+  filter(connection& c, route r)
+      : connection_(c),
+        queue_(connection_.get_implementation().get_dispatch_context()) {
+    entry_.r = std::move(r);
+    entry_.target = &queue_;
     connection_.new_filter(*this);
   }
 
-  ~filter() { connection_.delete_filter(*this); }
+  ~filter() {
+    connection_.delete_filter(*this);
+    unsubscribe();
+  }
+
+  /// Bound the number of messages buffered while no handler is waiting.
+  /**
+   * The buffer is unbounded by default, so a consumer that falls behind a
+   * flood of signals lets it grow without limit. The limit applies to a
+   * subscribed handler as well.
+   *
+   * @param max_messages The largest number of buffered messages, at least 1.
+   *
+   * @param p What to discard once the buffer is full.
+   */
+  void set_buffer_limit(std::size_t max_messages,
+                        overflow_policy p = overflow_policy::drop_oldest) {
+    queue_.set_limit(max_messages, p);
+  }
+
+  /// Call a handler with every message the filter accepts, until
+  /// unsubscribe().
+  /**
+   * Unlike starting another async_dispatch from each completion, the
+   * handler is stored once, and each message costs a single post to the
+   * connection's dispatch context. Messages buffered so far are delivered
+   * first, and the handler is called for one message at a time, in order.
+   * While subscribed, async_dispatch handlers get nothing.
+   *
+   * Messages stay in the filter's buffer until the handler is called with
+   * them, so set_buffer_limit() and its overflow_policy bound how far a slow
+   * handler may fall behind.
+   *
+   * @param handler Called as void(asio::error_code, dbus::message). Under
+   * overflow_policy::report, the error is asio::error::no_buffer_space once
+   * messages were discarded, before the messages that were kept.
+   */
+  template <typename MessageHandler>
+  void subscribe(MessageHandler&& handler) {
+    unsubscribe();
+    subscriber_ = std::make_shared<detail::queue<message>::subscriber>(
+        std::forward<MessageHandler>(handler));
+    queue_.subscribe(subscriber_);
+    // begin asynchronous operation
+    connection_.get_implementation().start();
+  }
+
+  /// Stop calling the subscribed handler.
+  /**
+   * Messages the handler has not been called with yet stay buffered for
+   * async_dispatch. A call already running on another thread may still be
+   * in progress.
+   */
+  void unsubscribe() {
+    if (!subscriber_) return;
+    queue_.subscribe(nullptr);
+    subscriber_.reset();
+  }
+
+  /// Counters for tuning the buffer limit.
+  queue_stats get_stats() const { return queue_.get_stats(); }
 
+  /// Wait for the next message accepted by the filter.
+  /**
+   * A cancellation slot bound to the handler (asio::bind_cancellation_slot)
+   * stops the wait: the handler completes with asio::error::operation_aborted
+   * and the next message goes to another waiting handler, or is buffered.
+   *
+   * Under overflow_policy::report, the handler completes with
+   * asio::error::no_buffer_space once messages have been discarded.
+   */
   template <typename MessageHandler>
   inline ASIO_INITFN_RESULT_TYPE(MessageHandler, void(asio::error_code, message))
   async_dispatch(ASIO_MOVE_ARG(MessageHandler) handler) {
     // begin asynchronous operation
-    connection_.get_implementation().start(connection_.get_executor().context());
+    connection_.get_implementation().start();
 
     return queue_.async_pop(ASIO_MOVE_CAST(MessageHandler)(handler));
   }
@@ -7,9 +7,14 @@
 #define DBUS_CONNECTION_IPP
 
 #include <dbus/dbus.h>
+#include <dbus/detail/match_registry.hpp>
+#include <dbus/detail/pending_calls.hpp>
+#include <dbus/detail/router.hpp>
 #include <dbus/detail/watch_timeout.hpp>
 
 #include <atomic>
+#include <functional>
+#include <memory>
 
 namespace dbus {
 namespace impl {
@@ -20,26 +25,47 @@ class connection {
 
  private:
   DBusConnection* conn;
+  detail::dispatch_context* context;
+  std::shared_ptr<detail::pending_calls> pending;
+  std::shared_ptr<detail::match_registry> matches;
+  std::shared_ptr<detail::router> routes;
 
  public:
-  connection() : is_paused(true), conn(NULL) {}
+  connection()
+      : is_paused(true),
+        conn(NULL),
+        context(NULL),
+        matches(std::make_shared<detail::match_registry>()),
+        routes(std::make_shared<detail::router>()) {}
 
   connection(const connection& other) = delete;  // non construction-copyable
   connection& operator=(const connection&) = delete;  // non copyable
   connection(connection&&) = delete;
   connection& operator=(connection&&) = delete;
 
-  void open(asio::io_context& io, int bus) {
+  void open(asio::io_context& io, int bus, bool serialized = false) {
+    // libdbus is entered from user threads as well as the io_context's, in
+    // either threading mode
+    dbus_threads_init_default();
+
     error e;
     conn = dbus_bus_get_private((DBusBusType)bus, e);
     e.throw_if_set();
 
     dbus_connection_set_exit_on_disconnect(conn, false);
 
-    detail::set_watch_timeout_dispatch_functions(conn, io);
+    context = &detail::set_watch_timeout_dispatch_functions(conn, io,
+                                                            serialized);
+    add_pending_calls_filter();
+    add_router_filter();
   }
 
-  void open(asio::io_context& io, const string& address) {
+  void open(asio::io_context& io, const string& address,
+            bool serialized = false) {
+    // libdbus is entered from user threads as well as the io_context's, in
+    // either threading mode
+    dbus_threads_init_default();
+
     error e;
     conn = dbus_connection_open_private(address.c_str(), e);
     e.throw_if_set();
@@ -49,7 +75,10 @@ class connection {
 
     dbus_connection_set_exit_on_disconnect(conn, false);
 
-    detail::set_watch_timeout_dispatch_functions(conn, io);
+    context = &detail::set_watch_timeout_dispatch_functions(conn, io,
+                                                            serialized);
+    add_pending_calls_filter();
+    add_router_filter();
   }
 
   void request_name(const string& name) {
@@ -75,6 +104,9 @@ class connection {
 
   ~connection() {
     if (conn != NULL) {
+      // open() may have failed after the connection was opened, before the
+      // table of pending calls was set up
+      if (pending) pending->abort();
       dbus_connection_close(conn);
       dbus_connection_unref(conn);
     }
@@ -88,6 +120,16 @@ class connection {
   }
 
   operator DBusConnection*() { return conn; }
+
+  detail::dispatch_context& get_dispatch_context() { return *context; }
+
+  detail::pending_calls& get_pending_calls() { return *pending; }
+
+  const std::shared_ptr<detail::match_registry>& get_match_registry() {
+    return matches;
+  }
+
+  detail::router& get_router() { return *routes; }
   operator const DBusConnection*() const { return conn; }
 
   message send_with_reply_and_block(message& m,
@@ -108,6 +150,46 @@ class connection {
     dbus_connection_send(conn, m, NULL);
   }
 
+  // Remove a match rule without waiting for the bus daemon's reply. Calls
+  // on a connection are handled in order, so the rule is gone before any
+  // AddMatch sent later is processed.
+  void remove_match(const string& rule) {
+    DBusMessage* m = dbus_message_new_method_call(
+        DBUS_SERVICE_DBUS, DBUS_PATH_DBUS, DBUS_INTERFACE_DBUS, "RemoveMatch");
+    if (m == NULL) return;
+    const char* r = rule.c_str();
+    if (dbus_message_append_args(m, DBUS_TYPE_STRING, &r, DBUS_TYPE_INVALID)) {
+      dbus_message_set_no_reply(m, TRUE);
+      dbus_connection_send(conn, m, NULL);
+    }
+    dbus_message_unref(m);
+  }
+
+  typedef std::function<bool(message&)> object_handler;
+
+  void register_object_path(const string& path, object_handler handler,
+                            bool fallback) {
+    static const DBusObjectPathVTable vtable = {
+        &unregister_object, &dispatch_object, NULL, NULL, NULL, NULL};
+
+    auto data = new object_handler(std::move(handler));
+    error e;
+    dbus_bool_t registered =
+        fallback ? dbus_connection_try_register_fallback(conn, path.c_str(),
+                                                         &vtable, data, e)
+                 : dbus_connection_try_register_object_path(
+                       conn, path.c_str(), &vtable, data, e);
+    if (!registered) {
+      delete data;
+      e.throw_if_set();
+    }
+  }
+
+  void unregister_object_path(const string& path) {
+    // libdbus calls unregister_object, which frees the handler
+    dbus_connection_unregister_object_path(conn, path.c_str());
+  }
+
   void send_with_reply(message& m, DBusPendingCall** p,
                        int timeout_in_milliseconds) {
     // TODO(Ed) check error code
@@ -115,19 +197,18 @@ class connection {
   }
 
   // begin asynchronous operation
-  // FIXME should not get io from an argument
-  void start(asio::io_context& io) {
+  void start() {
     bool old_value(true);
     if (is_paused.compare_exchange_strong(old_value, false)) {
       // If two threads call connection::async_send()
       // simultaneously on a paused connection, then
       // only one will pass the CAS instruction and
       // only one dispatch_handler will be injected.
-      detail::dispatch_handler::process(io, conn);
+      detail::dispatch_handler::process(*context, conn);
     }
   }
 
-  void cancel(asio::io_context& io) {
+  void cancel() {
     bool old_value(false);
     if (is_paused.compare_exchange_strong(old_value, true)) {
       // TODO
@@ -135,6 +216,52 @@ class connection {
   }
 
   void flush(void) { dbus_connection_flush(conn); }
+
+ private:
+  static void unregister_object(DBusConnection* c, void* userdata) {
+    delete static_cast<object_handler*>(userdata);
+  }
+
+  static DBusHandlerResult dispatch_object(DBusConnection* c, DBusMessage* m,
+                                           void* userdata) {
+#if !defined(ASIO_NO_EXCEPTIONS)
+    try {
+#endif  // !defined(ASIO_NO_EXCEPTIONS)
+      message m_(m);
+      // libdbus passes on every message for the path, signals included
+      if (m_.get_message_type() == message_type::method_call &&
+          (*static_cast<object_handler*>(userdata))(m_)) {
+        return DBUS_HANDLER_RESULT_HANDLED;
+      }
+#if !defined(ASIO_NO_EXCEPTIONS)
+    } catch (...) {
+      // do not throw in C callbacks. Just don't.
+    }
+#endif  // !defined(ASIO_NO_EXCEPTIONS)
+
+    return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+  }
+
+  // Installed first, so replies reach their callers before any user filter
+  // gets to see them.
+  void add_pending_calls_filter() {
+    pending = std::make_shared<detail::pending_calls>(*context);
+    dbus_connection_add_filter(
+        conn, &detail::pending_calls::filter,
+        new std::shared_ptr<detail::pending_calls>(pending), [](void* d) {
+          delete static_cast<std::shared_ptr<detail::pending_calls>*>(d);
+        });
+  }
+
+  // Every dbus::filter of the connection is reached through this one
+  // libdbus filter.
+  void add_router_filter() {
+    dbus_connection_add_filter(
+        conn, &detail::router::filter,
+        new std::shared_ptr<detail::router>(routes), [](void* d) {
+          delete static_cast<std::shared_ptr<detail::router>*>(d);
+        });
+  }
 };
 
 }  // namespace impl
@@ -7,35 +7,13 @@
 #define DBUS_FILTER_IPP
 
 namespace dbus {
-namespace impl {
-
-inline DBusHandlerResult filter_callback(DBusConnection* c, DBusMessage* m,
-                                         void* userdata) {
-#if !defined(ASIO_NO_EXCEPTIONS)
-  try {
-#endif // !defined(ASIO_NO_EXCEPTIONS)
-    filter& f = *static_cast<filter*>(userdata);
-    message m_(m);
-    if (f.offer(m_)) {
-      return DBUS_HANDLER_RESULT_HANDLED;
-    }
-#if !defined(ASIO_NO_EXCEPTIONS)
-  } catch (...) {
-    // do not throw in C callbacks. Just don't.
-  }
-#endif // !defined(ASIO_NO_EXCEPTIONS)
-
-  return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
-}
-
-}  // namespace impl
 
 void connection_service::new_filter(implementation_type& impl, filter& f) {
-  dbus_connection_add_filter(impl, &impl::filter_callback, &f, NULL);
+  impl.get_router().add(f.entry_);
 }
 
 void connection_service::delete_filter(implementation_type& impl, filter& f) {
-  dbus_connection_remove_filter(impl, &impl::filter_callback, &f);
+  impl.get_router().remove(f.entry_);
 }
 
 }  // namespace dbus
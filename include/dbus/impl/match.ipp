@@ -8,17 +8,40 @@
 
 namespace dbus {
 void connection_service::new_match(implementation_type& impl, match& m) {
-  error e;
-  dbus_bus_add_match(impl, m.get_expression().c_str(), e);
-  e.throw_if_set();
-  // eventually, for complete asynchronicity, this should connect to
-  // org.freedesktop.DBus and call AddMatch
+  auto& registry = *impl.get_match_registry();
+  if (registry.acquire(m.get_key())) {
+    error e;
+    dbus_bus_add_match(impl, m.get_key().c_str(), e);
+    registry.installed(m.get_key(), e.error_code());
+    if (e.is_set()) {
+      // the destructor will not run
+      registry.release(m.get_key());
+      e.throw_if_set();
+    }
+    return;
+  }
+
+  // An earlier holder installs the rule, possibly still asynchronously. Its
+  // reply may only be read once the io_context runs, perhaps on this very
+  // thread, so a pending rule is installed once more instead of waited for.
+  asio::error_code ec;
+  if (!registry.answered(m.get_key(), ec)) {
+    error e;
+    dbus_bus_add_match(impl, m.get_key().c_str(), e);
+    ec = e.error_code();
+    if (!ec) registry.add_copy(m.get_key());
+  }
+  if (ec) {
+    registry.release(m.get_key());
+    asio::detail::throw_error(ec, "match");
+  }
 }
 
 void connection_service::delete_match(implementation_type& impl, match& m) {
-  error e;
-  dbus_bus_remove_match(impl, m.get_expression().c_str(), e);
-  e.throw_if_set();
+  // not waited for, so destroying a match neither blocks nor throws
+  for (auto n = impl.get_match_registry()->release(m.get_key()); n > 0; --n) {
+    impl.remove_match(m.get_key());
+  }
 }
 
 }  // namespace dbus
@@ -30,7 +30,7 @@ class message_iterator {
   bool append_fixed_array(int code, const void *value, int n_elements);
 
   // reading
-  static bool init(message &m, message_iterator &i);
+  static bool init(const message &m, message_iterator &i);
 
   bool next();
   bool has_next();
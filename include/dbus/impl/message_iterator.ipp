@@ -43,9 +43,11 @@ inline bool message_iterator::append_fixed_array(int code, const void *value, in
   return dbus_message_iter_append_fixed_array(&DBusMessageIter_, code, value, n_elements);
 }
 
-inline bool message_iterator::init(message& m, message_iterator& i)
+inline bool message_iterator::init(const message& m, message_iterator& i)
 {
-  return dbus_message_iter_init(m, &i.DBusMessageIter_);
+  // reading the body leaves the message untouched
+  DBusMessage* d = const_cast<DBusMessage*>(static_cast<const DBusMessage*>(m));
+  return dbus_message_iter_init(d, &i.DBusMessageIter_);
 }
 
 inline bool message_iterator::next()
@@ -6,10 +6,15 @@
 #ifndef DBUS_MATCH_HPP
 #define DBUS_MATCH_HPP
 
+#include <memory>
+#include <set>
 #include <string>
+#include <utility>
+#include <vector>
 #include <asio.hpp>
 
 #include <dbus/connection.hpp>
+#include <dbus/detail/match_registry.hpp>
 #include <dbus/error.hpp>
 
 namespace dbus {
@@ -20,25 +25,170 @@ namespace dbus {
  *
  * Each rule will be represented by an instance of match. To remove that rule,
  * dispose of the object.
+ *
+ * Matches with equivalent expressions share one rule on the bus: only the
+ * first installs it and only the last removes it. See
+ * connection::get_match_rules().
  */
 class match {
   connection& connection_;
   std::string expression_;
+  std::string key_;
 
  public:
+  /// Install a rule, waiting for the bus daemon to acknowledge it.
+  /**
+   * If an equivalent rule is still being installed asynchronously, this
+   * sends an AddMatch of its own rather than waiting for that one, so it
+   * does not depend on the io_context running.
+   *
+   * @throws asio::system_error When the rule was rejected.
+   */
   match(connection& c, ASIO_MOVE_ARG(std::string) e)
-      : connection_(c), expression_(ASIO_MOVE_CAST(std::string)(e)) {
+      : connection_(c),
+        expression_(ASIO_MOVE_CAST(std::string)(e)),
+        key_(detail::match_registry::normalize(expression_)) {
     connection_.new_match(*this);
   }
 
+  /// Install a rule without waiting for the bus daemon.
+  /**
+   * @param handler Called as void(asio::error_code) once the daemon has
+   * acknowledged the rule, or at once if an equivalent rule already was.
+   * The match may be destroyed before that.
+   */
+  template <typename InstalledHandler>
+  match(connection& c, ASIO_MOVE_ARG(std::string) e,
+        ASIO_MOVE_ARG(InstalledHandler) handler)
+      : connection_(c),
+        expression_(ASIO_MOVE_CAST(std::string)(e)),
+        key_(detail::match_registry::normalize(expression_)) {
+    connection_.async_acquire_matches(
+        std::vector<std::string>{key_},
+        ASIO_MOVE_CAST(InstalledHandler)(handler));
+  }
+
   ~match() { connection_.delete_match(*this); }
 
   const std::string& get_expression() const { return expression_; }
 
+  /// The expression in canonical form, as sent to the bus daemon.
+  const std::string& get_key() const { return key_; }
+
   match(match&&) = delete;
   match& operator=(match&&) = delete;
 };
 
+/// A group of match rules installed and removed in batches.
+/**
+ * Each batch of AddMatch or RemoveMatch calls is queued at once, so it costs
+ * a single round trip to the bus daemon however many rules it holds. Rules
+ * still in the set are removed, without waiting, when it is destroyed.
+ *
+ * Rules are shared with dbus::match objects and other sets on the same
+ * connection, so a batch only sends the calls for rules gaining their first
+ * or losing their last holder.
+ */
+class match_set {
+  typedef std::set<std::string> rules_type;
+
+  connection& connection_;
+  // shared with pending additions, which drop the rules that failed
+  std::shared_ptr<rules_type> rules_;
+
+ public:
+  explicit match_set(connection& c)
+      : connection_(c), rules_(std::make_shared<rules_type>()) {}
+
+  ~match_set() {
+    auto& impl = connection_.get_implementation();
+    for (auto& rule : *rules_) {
+      for (auto n = impl.get_match_registry()->release(rule); n > 0; --n)
+        impl.remove_match(rule);
+    }
+  }
+
+  match_set(const match_set&) = delete;
+  match_set& operator=(const match_set&) = delete;
+
+  /// Install rules not yet in the set.
+  /**
+   * Rules are in the set from the start, so that adding them again while
+   * they are pending sends nothing. Those the bus daemon rejected are taken
+   * out of the set again before the handler runs, and may be retried.
+   *
+   * @param token Completion token with the signature void(asio::error_code),
+   * called once every new rule is acknowledged. The error code is that of
+   * the first rule to fail.
+   */
+  template <typename CompletionToken>
+  auto async_add(const std::vector<std::string>& rules,
+                 CompletionToken&& token) {
+    std::vector<std::string> added;
+    for (auto& rule : rules) {
+      std::string key = detail::match_registry::normalize(rule);
+      if (rules_->insert(key).second) added.push_back(std::move(key));
+    }
+    return asio::async_initiate<CompletionToken, void(asio::error_code)>(
+        initiate_add{connection_, rules_}, token, std::move(added));
+  }
+
+  /// Remove rules from the set.
+  /**
+   * @param token Completion token with the signature void(asio::error_code),
+   * called once the removal of every rule is acknowledged.
+   */
+  template <typename CompletionToken>
+  auto async_remove(const std::vector<std::string>& rules,
+                    CompletionToken&& token) {
+    auto& registry = *connection_.get_implementation().get_match_registry();
+    std::vector<std::string> removed;
+    for (auto& rule : rules) {
+      std::string key = detail::match_registry::normalize(rule);
+      if (!rules_->erase(key)) continue;
+      for (auto n = registry.release(key); n > 0; --n) removed.push_back(key);
+    }
+    return connection_.async_bus_batch("RemoveMatch", removed,
+                                       std::forward<CompletionToken>(token));
+  }
+
+  bool contains(const std::string& rule) const {
+    return rules_->count(detail::match_registry::normalize(rule));
+  }
+
+  std::size_t size() const { return rules_->size(); }
+
+ private:
+  // Acquires the rules, then drops those that failed from the set, if it
+  // still exists, before completing on the handler's executor.
+  struct initiate_add {
+    connection& connection_;
+    std::weak_ptr<rules_type> rules_;
+
+    template <typename Handler>
+    void operator()(Handler&& handler, std::vector<std::string> keys) const {
+      auto ex = asio::get_associated_executor(handler,
+                                              connection_.get_executor());
+      auto registry = connection_.get_implementation().get_match_registry();
+      auto done = asio::bind_executor(
+          ex, [handler = std::forward<Handler>(handler), keys, registry,
+               weak = rules_](asio::error_code ec) mutable {
+            auto rules = weak.lock();
+            if (ec && rules) {
+              for (auto& key : keys) {
+                if (registry->get_error(key) && rules->erase(key)) {
+                  // never installed, so there is nothing to remove
+                  registry->release(key);
+                }
+              }
+            }
+            handler(ec);
+          });
+      connection_.async_acquire_matches(std::move(keys), std::move(done));
+    }
+  };
+};
+
 }  // namespace dbus
 
 #include <dbus/impl/match.ipp>
@@ -11,14 +11,28 @@
 #include <dbus/endpoint.hpp>
 #include <dbus/impl/message_iterator.hpp>
 #include <dbus/support.hpp>
+#include <cstring>
 #include <functional>
 #include <iostream>
 #include <memory>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <utility>
 #include <variant>
 #include <vector>
 
 namespace dbus {
 
+/// The kind of a message, as in its header.
+enum class message_type {
+  invalid = DBUS_MESSAGE_TYPE_INVALID,
+  method_call = DBUS_MESSAGE_TYPE_METHOD_CALL,
+  method_return = DBUS_MESSAGE_TYPE_METHOD_RETURN,
+  error = DBUS_MESSAGE_TYPE_ERROR,
+  signal = DBUS_MESSAGE_TYPE_SIGNAL
+};
+
 class message {
  private:
   std::shared_ptr<DBusMessage> message_;
@@ -101,6 +115,51 @@ class message {
     return sanitize(dbus_message_get_destination(message_.get()));
   }
 
+  message_type get_message_type() const {
+    return static_cast<message_type>(dbus_message_get_type(message_.get()));
+  }
+
+  /// Header fields without copying; empty if the field is not set.
+  /**
+   * The views point into the message and are valid while it lives.
+   */
+  std::string_view get_path_view() const {
+    return view(dbus_message_get_path(message_.get()));
+  }
+
+  std::string_view get_interface_view() const {
+    return view(dbus_message_get_interface(message_.get()));
+  }
+
+  std::string_view get_member_view() const {
+    return view(dbus_message_get_member(message_.get()));
+  }
+
+  std::string_view get_sender_view() const {
+    return view(dbus_message_get_sender(message_.get()));
+  }
+
+  std::string_view get_destination_view() const {
+    return view(dbus_message_get_destination(message_.get()));
+  }
+
+  std::string_view get_signature_view() const {
+    return view(dbus_message_get_signature(message_.get()));
+  }
+
+  /// Whether this is a call of a method, compared without copying.
+  bool is_method_call(std::string_view interface,
+                      std::string_view member) const {
+    return get_message_type() == message_type::method_call &&
+           get_member_view() == member && get_interface_view() == interface;
+  }
+
+  /// Whether this is a signal, compared without copying.
+  bool is_signal(std::string_view interface, std::string_view member) const {
+    return get_message_type() == message_type::signal &&
+           get_member_view() == member && get_interface_view() == interface;
+  }
+
   uint32 get_serial() const { return dbus_message_get_serial(message_.get()); }
 
   message& set_serial(uint32 serial) {
@@ -160,7 +219,8 @@ class message {
 
     template <typename Container>
     std::enable_if_t<has_const_iterator<Container>::value &&
-                     !is_string_type<Container>::value,
+                     !is_string_type<Container>::value &&
+                     !is_fixed_array<Container>::value,
                      bool>
     pack(const Container& c) {
       message::packer sub;
@@ -179,6 +239,30 @@ class message {
       return iter_.close_container(sub.iter_);
     }
 
+    // Contiguous fixed type arrays are copied into the message in one go
+    template <typename Container>
+    std::enable_if_t<is_fixed_array<Container>::value, bool> pack(
+        const Container& c) {
+      typedef std::remove_cv_t<typename Container::value_type> value_type;
+      if (c.size() > DBUS_MAXIMUM_ARRAY_LENGTH / sizeof(value_type)) {
+        return false;
+      }
+      message::packer sub;
+
+      static const constexpr auto signature =
+          element_signature<value_type>::code;
+      if (iter_.open_container(DBUS_TYPE_ARRAY, &signature[0], sub.iter_) ==
+          false) {
+        return false;
+      }
+      const value_type* data = c.data();
+      if (!sub.iter_.append_fixed_array(element<value_type>::code, &data,
+                                        static_cast<int>(c.size()))) {
+        return false;
+      }
+      return iter_.close_container(sub.iter_);
+    }
+
     bool pack(const char* c) {
       return iter_.append_basic(element<string>::code, &c);
     }
@@ -205,6 +289,19 @@ class message {
       return iter_.close_container(dict_entry.iter_);
     }
 
+    template <typename... Elements>
+    bool pack(const std::tuple<Elements...>& element) {
+      message::packer sub;
+      if (iter_.open_container(DBUS_TYPE_STRUCT, NULL, sub.iter_) == false) {
+        return false;
+      }
+      if (!std::apply([&](const auto&... e) { return sub.pack(e...); },
+                      element)) {
+        return false;
+      }
+      return iter_.close_container(sub.iter_);
+    }
+
     bool pack(const object_path& e) {
       const char* c = e.value.c_str();
       return iter_.append_basic(element<object_path>::code, &c);
@@ -215,6 +312,13 @@ class message {
       return pack(c);
     }
 
+    // D-Bus wants NUL terminated strings, which views need not be
+    bool pack(std::string_view e) { return pack(string(e)); }
+
+    bool pack(const object_path_view& e) {
+      return pack(object_path{string(e.value)});
+    }
+
     bool pack(const dbus_variant& v) {
       // Get the dbus typecode  of the variant being packed
       const char* type = std::visit(
@@ -243,8 +347,12 @@ class message {
 
   struct unpacker {
     impl::message_iterator iter_;
-    unpacker(message& m) { impl::message_iterator::init(m, iter_); }
+    // Whether element types are compared with the message as they are read.
+    // Cleared once the whole signature is known to match.
+    bool checked_ = true;
+    unpacker(const message& m) { impl::message_iterator::init(m, iter_); }
     unpacker() {}
+    explicit unpacker(bool checked) : checked_(checked) {}
 
     template <typename Element, typename... Args>
     bool unpack(Element& e, Args&... args) {
@@ -258,7 +366,7 @@ class message {
     template <typename Element>
     std::enable_if_t<is_fixed_type<Element>::value, bool> unpack(
         Element& e) {
-      if (iter_.get_arg_type() != element<Element>::code) {
+      if (!expect(element<Element>::code)) {
         return false;
       }
       iter_.get_basic(&e);
@@ -271,7 +379,7 @@ class message {
 
     // bool unpack specialization
     bool unpack(bool& s) {
-      if (iter_.get_arg_type() != element<bool>::code) {
+      if (!expect(element<bool>::code)) {
         return false;
       }
       int c;
@@ -283,7 +391,7 @@ class message {
 
     // std::string unpack specialization
     bool unpack(string& s) {
-      if (iter_.get_arg_type() != element<string>::code) {
+      if (!expect(element<string>::code)) {
         return false;
       }
       const char* c;
@@ -295,7 +403,7 @@ class message {
 
     // object_path unpack specialization
     bool unpack(object_path& s) {
-      if (iter_.get_arg_type() != element<object_path>::code) {
+      if (!expect(element<object_path>::code)) {
         return false;
       }
       const char* c;
@@ -307,7 +415,7 @@ class message {
 
     // object_path unpack specialization
     bool unpack(signature& s) {
-      if (iter_.get_arg_type() != element<signature>::code) {
+      if (!expect(element<signature>::code)) {
         return false;
       }
       const char* c;
@@ -317,9 +425,35 @@ class message {
       return true;
     }
 
+    // Fixed type arrays are borrowed from the message buffer, not copied
+    template <typename T>
+    std::enable_if_t<is_fixed_array_element<T>::value, bool> unpack(
+        array_view<T>& v) {
+      const T* data;
+      std::size_t size;
+      if (!get_fixed_array(data, size)) {
+        return false;
+      }
+      v = array_view<T>(data, size);
+      return true;
+    }
+
+    // Borrowed string unpack specializations, pointing into the message
+    bool unpack(std::string_view& s) {
+      return get_string(element<std::string_view>::code, s);
+    }
+
+    bool unpack(object_path_view& s) {
+      return get_string(element<object_path_view>::code, s.value);
+    }
+
+    bool unpack(signature_view& s) {
+      return get_string(element<signature_view>::code, s.value);
+    }
+
     // variant unpack specialization
     bool unpack(dbus_variant& v) {
-      if (iter_.get_arg_type() != element<dbus_variant>::code) {
+      if (!expect(element<dbus_variant>::code)) {
         return false;
       }
       message::unpacker sub;
@@ -342,15 +476,15 @@ class message {
     // dict entry unpack specialization
     template <typename Key, typename Value>
     bool unpack(std::pair<Key, Value>& v) {
-      auto this_code = iter_.get_arg_type();
+
       // This can't use element<std::pair> because there is a difference between
       // the dbus type code 'e' and the dbus signature code for dict entries
       // '{'.  Element_signature will return the full signature, and will never
       // return e, but we still want to type check it before recursing
-      if (this_code != DBUS_TYPE_DICT_ENTRY) {
+      if (!expect(DBUS_TYPE_DICT_ENTRY)) {
         return false;
       }
-      message::unpacker sub;
+      message::unpacker sub(checked_);
       iter_.recurse(sub.iter_);
       if (!sub.unpack(v.first)) {
         return false;
@@ -363,6 +497,33 @@ class message {
       return true;
     }
 
+    // struct unpack specialization
+    template <typename... Elements>
+    bool unpack(std::tuple<Elements...>& v) {
+      if (!expect(DBUS_TYPE_STRUCT)) {
+        return false;
+      }
+      message::unpacker sub(checked_);
+      iter_.recurse(sub.iter_);
+      if (!std::apply([&](auto&... e) { return sub.unpack(e...); }, v)) {
+        return false;
+      }
+      iter_.next();
+      return true;
+    }
+
+    // Map elements have a const key, which has to be unpacked before
+    // insertion
+    template <typename T>
+    struct mutable_value {
+      typedef T type;
+    };
+
+    template <typename Key, typename Value>
+    struct mutable_value<std::pair<const Key, Value>> {
+      typedef std::pair<Key, Value> type;
+    };
+
     template <typename T>
     struct has_emplace_method
 
@@ -403,24 +564,94 @@ class message {
                        decltype(test<T, dummy>(nullptr))>::value;
     };
 
+    template <typename T, typename = void>
+    struct has_reserve_method : std::false_type {};
+
+    template <typename T>
+    struct has_reserve_method<
+        T, std::void_t<decltype(std::declval<T>().reserve(0))>>
+        : std::true_type {};
+
+    // Maps with unique keys, whose elements can be decoded in place
+    template <typename T, typename = void>
+    struct has_try_emplace_method : std::false_type {};
+
+    template <typename T>
+    struct has_try_emplace_method<
+        T, std::void_t<decltype(std::declval<T>().try_emplace(
+               std::declval<typename T::key_type>()))>> : std::true_type {};
+
     template <typename Container>
     std::enable_if_t<has_emplace_back_method<Container>::value &&
                      !is_string_type<Container>::value,
                      bool>
     unpack(Container& c) {
-      auto top_level_arg_type = iter_.get_arg_type();
-      constexpr auto type = element_signature<Container>::code[0];
-      if (top_level_arg_type != type) {
+      if constexpr (is_fixed_array<Container>::value) {
+        const typename Container::value_type* data;
+        std::size_t size;
+        if (!get_fixed_array(data, size)) {
+          return false;
+        }
+        c.insert(c.end(), data, data + size);
+        return true;
+      } else {
+        if (!expect(element_signature<Container>::code[0])) {
+          return false;
+        }
+        // Counting the elements is cheap only for fixed types, and growing
+        // a container that already holds some is left to its own policy.
+        if constexpr (has_reserve_method<Container>::value &&
+                      is_fixed_type<typename Container::value_type>::value) {
+          if (c.empty()) c.reserve(iter_.get_element_count());
+        }
+        message::unpacker sub(checked_);
+
+        iter_.recurse(sub.iter_);
+        while (sub.iter_.get_arg_type() != DBUS_TYPE_INVALID) {
+          c.emplace_back();
+          if (!sub.unpack(c.back())) {
+            return false;
+          }
+        }
+        iter_.next();
+        return true;
+      }
+    }
+
+    // Only the key is unpacked into a temporary; the value is decoded
+    // straight into the map's node, overwriting it if the key is present.
+    template <typename Container>
+    std::enable_if_t<has_try_emplace_method<Container>::value, bool> unpack(
+        Container& c) {
+      if (!expect(element_signature<Container>::code[0])) {
         return false;
       }
-      message::unpacker sub;
+      message::unpacker sub(checked_);
 
       iter_.recurse(sub.iter_);
-      while (sub.iter_.get_arg_type() != DBUS_TYPE_INVALID) {
-        c.emplace_back();
-        if (!sub.unpack(c.back())) {
+      while (sub.iter_.get_arg_type() == DBUS_TYPE_DICT_ENTRY) {
+        message::unpacker entry(checked_);
+        sub.iter_.recurse(entry.iter_);
+
+        typename Container::key_type key;
+        if (!entry.unpack(key)) {
           return false;
         }
+        auto inserted = c.try_emplace(std::move(key));
+        auto& value = inserted.first->second;
+        if (!inserted.second) {
+          reset(value);
+        }
+        if (!entry.unpack(value)) {
+          if (inserted.second) {
+            c.erase(inserted.first);
+          }
+          return false;
+        }
+        sub.iter_.next();
+      }
+      if (sub.iter_.get_arg_type() != DBUS_TYPE_INVALID) {
+        return false;
       }
       iter_.next();
       return true;
@@ -428,26 +659,18 @@ class message {
 
     template <typename Container>
     std::enable_if_t<has_emplace_method<Container>::value &&
+                     !has_try_emplace_method<Container>::value &&
                      !is_string_type<Container>::value,
                      bool>
     unpack(Container& c) {
-      auto top_level_arg_type = iter_.get_arg_type();
-      constexpr auto type = element_signature<Container>::code[0];
-      if (top_level_arg_type != type) {
+      if (!expect(element_signature<Container>::code[0])) {
         return false;
       }
-      message::unpacker sub;
+      message::unpacker sub(checked_);
 
       iter_.recurse(sub.iter_);
       while (sub.iter_.get_arg_type() != DBUS_TYPE_INVALID) {
-        // TODO(ed) this is done as an unpack to a stack variable, then an
-        // emplace move into the container (as the key isn't known until the
-        // unpack is done)  This could be made more efficient by unpacking only
-        // the key type into a temporary, using find on the temporary, then
-        // unpacking directly into the map type, instead of unpacking both key
-        // and value.
-
-        typename Container::value_type t;
+        typename mutable_value<typename Container::value_type>::type t;
         if (!sub.unpack(t)) {
           return false;
         }
@@ -456,17 +679,91 @@ class message {
       iter_.next();
       return true;
     }
+
+    // Containers append when unpacked into, so one that is being overwritten
+    // is emptied first, keeping its storage. Structs and dict entries are
+    // emptied member by member, as they may hold containers.
+    template <typename T>
+    static void reset(T& value) {
+      if constexpr (has_const_iterator<T>::value &&
+                    !is_string_type<T>::value) {
+        value.clear();
+      }
+    }
+
+    template <typename... Elements>
+    static void reset(std::tuple<Elements...>& value) {
+      std::apply([](auto&... e) { (reset(e), ...); }, value);
+    }
+
+    template <typename Key, typename Value>
+    static void reset(std::pair<Key, Value>& value) {
+      reset(value.first);
+      reset(value.second);
+    }
+
+   private:
+    bool expect(int code) { return !checked_ || iter_.get_arg_type() == code; }
+
+    bool get_string(int code, std::string_view& s) {
+      if (!expect(code)) {
+        return false;
+      }
+      const char* c;
+      iter_.get_basic(&c);
+      s = c;
+      iter_.next();
+      return true;
+    }
+
+    template <typename T>
+    bool get_fixed_array(const T*& data, std::size_t& size) {
+      if (checked_ && (iter_.get_arg_type() != DBUS_TYPE_ARRAY ||
+                       iter_.get_element_type() != element<T>::code)) {
+        return false;
+      }
+      message::unpacker sub;
+      iter_.recurse(sub.iter_);
+      int n = 0;
+      data = nullptr;
+      sub.iter_.get_fixed_array(&data, &n);
+      size = static_cast<std::size_t>(n);
+      iter_.next();
+      return true;
+    }
   };
 
+  /// Whether the body's signature is exactly that of the given types.
   template <typename... Args>
-  bool unpack(Args&... args) {
-    return unpacker(*this).unpack(args...);
+  bool has_signature() const {
+    static const constexpr auto expected = args_signature<Args...>::code;
+    const char* actual = dbus_message_get_signature(message_.get());
+    return actual != NULL && std::strcmp(actual, expected.data()) == 0;
+  }
+
+  /// Unpack the leading arguments of the body.
+  /**
+   * When the arguments are all of the body, the signature is compared once
+   * and the elements are then read without checking each one's type.
+   */
+  template <typename... Args>
+  bool unpack(Args&... args) const {
+    unpacker u(*this);
+    if constexpr (std::conjunction<
+                      has_element_signature<std::decay_t<Args>>...>::value) {
+      u.checked_ = !has_signature<Args...>();
+    }
+    return u.unpack(args...);
   }
 
  private:
   static std::string sanitize(const char* str) {
     return (str == NULL) ? "(null)" : str;
   }
+
+  static std::string_view view(const char* str) {
+    return (str == NULL) ? std::string_view() : std::string_view(str);
+  }
 };
 
 inline std::ostream& operator<<(std::ostream& os, const message& m) {
@@ -591,9 +888,20 @@ constexpr bool unpack_into_tuple(std::tuple<>& t, dbus::message& m) {
   return true;
 }
 
+template <class... Args>
+inline bool validate_args_num_impl(dbus::message& m, std::tuple<Args...>*) {
+  if constexpr (std::conjunction<
+                    dbus::has_element_signature<std::decay_t<Args>>...>::value) {
+    if (m.has_signature<Args...>()) {
+      return true;
+    }
+  }
+  return m.get_args_num() == sizeof...(Args);
+}
+
 template <class Tuple>
 inline bool validate_args_num(dbus::message& m) {
-  return m.get_args_num() == std::tuple_size<Tuple>{};
+  return validate_args_num_impl(m, static_cast<Tuple*>(nullptr));
 }
 
 template <typename... Args>
@@ -0,0 +1,79 @@
+// Copyright (c) Benjamin Kietzman (github.com/bkietz)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+#ifndef DBUS_MESSAGE_TEMPLATE_HPP
+#define DBUS_MESSAGE_TEMPLATE_HPP
+
+#include <dbus/dbus.h>
+#include <dbus/element.hpp>
+#include <dbus/endpoint.hpp>
+#include <dbus/message.hpp>
+
+namespace dbus {
+
+/// A prebuilt message header for calls or signals sent over and over.
+/**
+ * message::new_call and message::new_signal validate and marshal every
+ * header field each time. A template does that once; create() then copies
+ * the already marshalled header and only the body is appended.
+ *
+ * Templates are immutable, so one may be shared between threads.
+ */
+class message_template {
+ public:
+  /// Template for method calls to an endpoint.
+  static message_template call(const endpoint& destination) {
+    return message_template(message::new_call(destination));
+  }
+
+  /// Template for method calls of a member other than the endpoint's.
+  static message_template call(const endpoint& destination,
+                               const string& method_name) {
+    return message_template(message::new_call(destination, method_name));
+  }
+
+  /// Template for signals emitted from an endpoint.
+  static message_template signal(const endpoint& origin,
+                                 const string& signal_name) {
+    return message_template(message::new_signal(origin, signal_name));
+  }
+
+  /// Use a message, including any body it already has, as the prototype.
+  explicit message_template(message prototype)
+      : prototype_(std::move(prototype)) {}
+
+  /// A new message with the template's header and body, and no serial.
+  message create() const {
+    DBusMessage* m = dbus_message_copy(prototype_);
+    if (m == NULL) {
+      return message();
+    }
+    message copy(m);
+    dbus_message_unref(m);
+    return copy;
+  }
+
+  /// A new message with args appended to the template's body.
+  /**
+   * @return A null message if args could not be packed.
+   */
+  template <typename... Args>
+  message create(const Args&... args) const {
+    message m = create();
+    if (m == nullptr || !m.pack(args...)) {
+      return message();
+    }
+    return m;
+  }
+
+  const message& get_prototype() const { return prototype_; }
+
+ private:
+  message prototype_;
+};
+
+}  // namespace dbus
+
+#endif  // DBUS_MESSAGE_TEMPLATE_HPP
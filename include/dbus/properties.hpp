@@ -4,6 +4,7 @@
 #include <dbus/connection.hpp>
 #include <dbus/filter.hpp>
 #include <dbus/match.hpp>
+#include <algorithm>
 #include <functional>
 #include <map>
 #include <set>
@@ -187,7 +188,8 @@ class DbusInterface {
   get_signals() {
     return dbus_signals;
   };
-  virtual const std::map<std::string, std::shared_ptr<DbusMethod>>&
+  virtual const std::map<std::string, std::shared_ptr<DbusMethod>,
+                         std::less<>>&
   get_methods() {
     return dbus_methods;
   };
@@ -287,17 +289,18 @@ class DbusInterface {
     return sig;
   }
 
-  void call(dbus::message& m) {
-    std::string method_name = m.get_member();
-    auto method = dbus_methods.find(method_name);
-    if (method != dbus_methods.end()) {
-      method->second->call(m);
-    }  // TODO(ed) send something when method doesn't exist?
+  bool call(dbus::message& m) {
+    auto method = dbus_methods.find(m.get_member_view());
+    if (method == dbus_methods.end()) {
+      return false;
+    }
+    method->second->call(m);
+    return true;
   }
 
   std::string object_name;
   std::string interface_name;
-  std::map<std::string, std::shared_ptr<DbusMethod>> dbus_methods;
+  std::map<std::string, std::shared_ptr<DbusMethod>, std::less<>> dbus_methods;
   std::map<std::string, std::shared_ptr<DbusSignal>> dbus_signals;
   std::map<std::string, dbus_variant> properties_map;
   dbus::connection& conn;
@@ -393,11 +396,13 @@ class DbusObject {
 
   auto const& get_interfaces() const { return interfaces; }
 
-  void call(dbus::message& m) {
-    auto interface = interfaces.find(m.get_interface());
-    if (interface != interfaces.end()) {
-      interface->second->call(m);
-    }  // TODO(ed) send something when interface doesn't exist?
+  /// Handle a method call; false if no interface has the method.
+  bool call(dbus::message& m) {
+    auto interface = interfaces.find(m.get_interface_view());
+    if (interface == interfaces.end()) {
+      return false;
+    }
+    return interface->second->call(m);
   }
 
   std::string object_name;
@@ -409,95 +414,46 @@ class DbusObject {
   std::shared_ptr<DbusInterface> object_manager_iface;
 
   std::function<void(asio::error_code, message)> callback;
-  std::map<std::string, std::shared_ptr<DbusInterface>> interfaces;
+  std::map<std::string, std::shared_ptr<DbusInterface>, std::less<>>
+      interfaces;
 };
 
 class DbusObjectServer {
  public:
   DbusObjectServer(dbus::connection& conn) : conn(conn) {
     introspect_filter =
-        std::make_unique<dbus::filter>(conn, [](dbus::message m) {
-          if (m.get_type() != "method_call") {
-            return false;
-          }
-          if (m.get_interface() != "org.freedesktop.DBus.Introspectable") {
-            return false;
-          }
-          if (m.get_member() != "Introspect") {
-            return false;
-          };
-          return true;
-        });
+        std::make_unique<dbus::filter>(conn, dbus::route{
+            dbus::message_type::method_call,
+            "org.freedesktop.DBus.Introspectable", "Introspect"});
 
-    introspect_filter->async_dispatch(
-        [&](const asio::error_code ec, dbus::message m) {
+    introspect_filter->subscribe(
+        [this](const asio::error_code ec, dbus::message m) {
           on_introspect(ec, m);
         });
 
     object_manager_filter =
-        std::make_unique<dbus::filter>(conn, [](dbus::message m) {
+        std::make_unique<dbus::filter>(conn, dbus::route{
+            dbus::message_type::method_call,
+            "org.freedesktop.DBus.ObjectManager", "GetManagedObjects"});
 
-          if (m.get_type() != "method_call") {
-            return false;
-          }
-          if (m.get_interface() != "org.freedesktop.DBus.ObjectManager") {
-            return false;
-          }
-          if (m.get_member() != "GetManagedObjects") {
-            return false;
-          };
-          return true;
-        });
-
-    object_manager_filter->async_dispatch(
-        [&](const asio::error_code ec, dbus::message m) {
+    object_manager_filter->subscribe(
+        [this](const asio::error_code ec, dbus::message m) {
           on_get_managed_objects(ec, m);
         });
-
-    method_filter = std::make_unique<dbus::filter>(conn, [](dbus::message m) {
-
-      if (m.get_type() != "method_call") {
-        return false;
-      }
-      return true;
-    });
-
-    method_filter->async_dispatch(
-        [&](const asio::error_code ec, dbus::message m) {
-          on_method_call(ec, m);
-        });
   };
 
+  ~DbusObjectServer() {
+    for (auto& object : objects) {
+      conn.unregister_object_path(object->object_name);
+    }
+  }
+
   dbus::connection& get_connection() { return conn; }
   void on_introspect(const asio::error_code ec, dbus::message m) {
     auto xml = get_xml_for_path(m.get_path());
     auto ret = dbus::message::new_return(m);
     ret.pack(xml);
     conn.async_send(ret, [](const asio::error_code ec, dbus::message r) {});
-
-    introspect_filter->async_dispatch(
-        [&](const asio::error_code ec, dbus::message m) {
-          on_introspect(ec, m);
-        });
-  }
-
-  void on_method_call(const asio::error_code ec, dbus::message m) {
-    if (ec) {
-      std::cerr << "on_method_call error: " << ec << "\n";
-    } else {
-      auto path = m.get_path();
-      // TODO(ed) objects should be a map
-      for (auto& object : objects) {
-        if (object->object_name == path) {
-          object->call(m);
-          break;
-        }
-      }
-    }
-    method_filter->async_dispatch(
-        [&](const asio::error_code ec, dbus::message m) {
-          on_method_call(ec, m);
-        });
   }
 
   void on_get_managed_objects(const asio::error_code ec,
@@ -525,11 +481,6 @@ class DbusObjectServer {
     auto ret = dbus::message::new_return(m);
     ret.pack(dict);
     conn.async_send(ret, [](const asio::error_code ec, dbus::message r) {});
-
-    object_manager_filter->async_dispatch(
-        [&](const asio::error_code ec, dbus::message m) {
-          on_get_managed_objects(ec, m);
-        });
   }
 
   std::shared_ptr<DbusObject> add_object(const std::string& name) {
@@ -538,12 +489,28 @@ class DbusObjectServer {
     return x;
   }
 
+  /// Serve the method calls for the object's path.
+  /**
+   * Calls are routed by libdbus's object path tree, so their cost does not
+   * depend on the number of objects.
+   */
   void register_object(std::shared_ptr<DbusObject> object) {
-    objects.emplace_back(object);
+    register_path(object, false);
+  }
+
+  /// Serve the method calls for the object's path, and for the paths below
+  /// it that have no object of their own.
+  void register_fallback(std::shared_ptr<DbusObject> object) {
+    register_path(object, true);
   }
 
   void remove_object(std::shared_ptr<DbusObject> object) {
-    std::remove(objects.begin(), objects.end(), object);
+    auto it = std::find(objects.begin(), objects.end(), object);
+    if (it == objects.end()) {
+      return;
+    }
+    conn.unregister_object_path(object->object_name);
+    objects.erase(it);
   }
 
   void flush(void) { conn.flush(); }
@@ -672,11 +639,23 @@ class DbusObjectServer {
   }
 
  private:
+  void register_path(std::shared_ptr<DbusObject>& object, bool fallback) {
+    // The handler runs inside dbus_connection_dispatch, which may race with
+    // remove_object on another thread; hold the object for the whole call.
+    std::weak_ptr<DbusObject> weak = object;
+    conn.register_object_path(object->object_name,
+                              [weak](dbus::message& m) {
+                                std::shared_ptr<DbusObject> o = weak.lock();
+                                return o && o->call(m);
+                              },
+                              fallback);
+    objects.emplace_back(object);
+  }
+
   dbus::connection& conn;
   std::vector<std::shared_ptr<DbusObject>> objects;
   std::unique_ptr<dbus::filter> introspect_filter;
   std::unique_ptr<dbus::filter> object_manager_filter;
-  std::unique_ptr<dbus::filter> method_filter;
 };
 }
 
@@ -0,0 +1,201 @@
+// Copyright (c) Benjamin Kietzman (github.com/bkietz)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+#ifndef DBUS_SIGNAL_HUB_HPP
+#define DBUS_SIGNAL_HUB_HPP
+
+#include <dbus/connection.hpp>
+#include <dbus/detail/router.hpp>
+#include <dbus/message.hpp>
+#include <asio/detail/mutex.hpp>
+#include <asio/post.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace dbus {
+namespace detail {
+
+// A handler subscribed to a signal_hub, with the executor it runs on.
+struct hub_subscriber : std::enable_shared_from_this<hub_subscriber> {
+  std::atomic<bool> active{true};
+
+  virtual ~hub_subscriber() {}
+  virtual void deliver(const message& m) = 0;
+};
+
+template <typename Executor, typename Handler>
+struct hub_subscriber_impl final : hub_subscriber {
+  Executor executor;
+  Handler handler;
+
+  hub_subscriber_impl(const Executor& ex, Handler h)
+      : executor(ex), handler(std::move(h)) {}
+
+  void deliver(const message& m) override {
+    auto self = std::static_pointer_cast<hub_subscriber_impl>(
+        this->shared_from_this());
+    asio::post(executor, [self, m] {
+      // unsubscribing on the handler's executor stops later deliveries
+      if (self->active.load(std::memory_order_acquire)) self->handler(m);
+    });
+  }
+};
+
+// The subscribers of a hub. Deliveries work on a snapshot, so subscribing
+// and unsubscribing never wait for one to finish.
+class hub_state {
+ public:
+  typedef ::asio::detail::mutex mutex_type;
+  typedef std::vector<std::shared_ptr<hub_subscriber>> list_type;
+
+  void add(std::shared_ptr<hub_subscriber> s) {
+    mutex_type::scoped_lock lock(mutex_);
+    auto next = std::make_shared<list_type>(*subscribers_);
+    next->push_back(std::move(s));
+    subscribers_ = std::move(next);
+  }
+
+  void remove(const std::shared_ptr<hub_subscriber>& s) {
+    mutex_type::scoped_lock lock(mutex_);
+    auto next = std::make_shared<list_type>(*subscribers_);
+    next->erase(std::remove(next->begin(), next->end(), s), next->end());
+    subscribers_ = std::move(next);
+  }
+
+  std::shared_ptr<const list_type> get() {
+    mutex_type::scoped_lock lock(mutex_);
+    return subscribers_;
+  }
+
+  void deliver(const message& m) {
+    for (auto& s : *get()) s->deliver(m);
+  }
+
+ private:
+  mutex_type mutex_;
+  std::shared_ptr<const list_type> subscribers_ =
+      std::make_shared<list_type>();
+};
+
+}  // namespace detail
+
+/// Delivers each message on a route to every subscribed handler.
+/**
+ * A filter hands a message to a single waiting handler, so components
+ * interested in the same signal each need a filter of their own. A hub looks
+ * the message up once and posts the same message, which handlers must not
+ * modify, to each subscriber's executor.
+ *
+ * Messages on the route are taken from the connection even while nobody is
+ * subscribed, and are then discarded.
+ */
+class signal_hub {
+ public:
+  /// Ends a subscription when destroyed or reset.
+  class subscription {
+   public:
+    subscription() = default;
+    subscription(subscription&&) = default;
+    subscription& operator=(subscription&& other) {
+      reset();
+      state_ = std::move(other.state_);
+      subscriber_ = std::move(other.subscriber_);
+      return *this;
+    }
+    ~subscription() { reset(); }
+
+    /// Stop deliveries.
+    /**
+     * Deliveries already posted are skipped, but one running concurrently on
+     * another thread may still be in progress.
+     */
+    void reset() {
+      if (!subscriber_) return;
+      if (auto state = state_.lock()) state->remove(subscriber_);
+      subscriber_->active.store(false, std::memory_order_release);
+      state_.reset();
+      subscriber_.reset();
+    }
+
+    explicit operator bool() const { return subscriber_ != nullptr; }
+
+   private:
+    friend class signal_hub;
+    subscription(std::weak_ptr<detail::hub_state> st,
+                 std::shared_ptr<detail::hub_subscriber> s)
+        : state_(std::move(st)), subscriber_(std::move(s)) {}
+
+    std::weak_ptr<detail::hub_state> state_;
+    std::shared_ptr<detail::hub_subscriber> subscriber_;
+  };
+
+  signal_hub(connection& c, route r)
+      : connection_(c), state_(std::make_shared<detail::hub_state>()) {
+    entry_.r = std::move(r);
+    entry_.deliver = [state = state_](message& m) { state->deliver(m); };
+    connection_.get_implementation().get_router().add(entry_);
+  }
+
+  signal_hub(const signal_hub&) = delete;
+  signal_hub& operator=(const signal_hub&) = delete;
+
+  /// Outstanding subscriptions are left without a hub and end quietly.
+  ~signal_hub() {
+    connection_.get_implementation().get_router().remove(entry_);
+  }
+
+  /// Call handler with every message on the route, on an executor.
+  /**
+   * @param handler Called as void(const dbus::message&).
+   */
+  template <typename Executor, typename Handler>
+  std::enable_if_t<asio::is_executor<Executor>::value ||
+                       asio::execution::is_executor<Executor>::value,
+                   subscription>
+  subscribe(const Executor& ex, Handler&& handler) {
+    auto s = std::make_shared<
+        detail::hub_subscriber_impl<Executor, std::decay_t<Handler>>>(
+        ex, std::forward<Handler>(handler));
+    state_->add(s);
+    // begin asynchronous operation
+    connection_.get_implementation().start();
+    return subscription(state_, std::move(s));
+  }
+
+  /// Call handler with every message on the route, on the executor of an
+  /// execution context such as an io_context.
+  template <typename ExecutionContext, typename Handler>
+  std::enable_if_t<
+      std::is_convertible<ExecutionContext&, asio::execution_context&>::value,
+      subscription>
+  subscribe(ExecutionContext& ctx, Handler&& handler) {
+    return subscribe(ctx.get_executor(), std::forward<Handler>(handler));
+  }
+
+  /// Call handler with every message on the route, on the connection's
+  /// executor.
+  template <typename Handler>
+  subscription subscribe(Handler&& handler) {
+    return subscribe(connection_.get_executor(),
+                     std::forward<Handler>(handler));
+  }
+
+  std::size_t size() { return state_->get()->size(); }
+
+ private:
+  connection& connection_;
+  std::shared_ptr<detail::hub_state> state_;
+  detail::router::entry entry_;
+};
+
+}  // namespace dbus
+
+#endif  // DBUS_SIGNAL_HUB_HPP
@@ -0,0 +1,755 @@
+// Copyright (c) Benjamin Kietzman (github.com/bkietz)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+#ifndef DBUS_WIRE_HPP
+#define DBUS_WIRE_HPP
+
+#include <dbus/dbus.h>
+#include <dbus/element.hpp>
+#include <dbus/message.hpp>
+#include <dbus/support.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+namespace dbus {
+
+/// Direct encoding and decoding of the D-Bus wire format.
+/**
+ * message::pack and message::unpack go through DBusMessageIter, which
+ * validates and bookkeeps every element. The writer and reader here work on
+ * a contiguous buffer instead, with the layout of each type known at compile
+ * time from element_signature.
+ */
+namespace wire {
+
+inline char native_byte_order() {
+  const std::uint16_t one = 1;
+  return *reinterpret_cast<const char*>(&one) ? DBUS_LITTLE_ENDIAN
+                                              : DBUS_BIG_ENDIAN;
+}
+
+template <typename T>
+void swap_bytes(T& v) {
+  char* p = reinterpret_cast<char*>(&v);
+  for (std::size_t i = 0; i < sizeof(T) / 2; ++i) {
+    std::swap(p[i], p[sizeof(T) - 1 - i]);
+  }
+}
+
+/// Alignment of a type in the wire format, from its type code.
+constexpr std::size_t alignment(int code) {
+  switch (code) {
+    case DBUS_TYPE_INT16:
+    case DBUS_TYPE_UINT16:
+      return 2;
+    case DBUS_TYPE_BOOLEAN:
+    case DBUS_TYPE_INT32:
+    case DBUS_TYPE_UINT32:
+    case DBUS_TYPE_STRING:
+    case DBUS_TYPE_OBJECT_PATH:
+    case DBUS_TYPE_ARRAY:
+    case DBUS_TYPE_UNIX_FD:
+      return 4;
+    case DBUS_TYPE_INT64:
+    case DBUS_TYPE_UINT64:
+    case DBUS_TYPE_DOUBLE:
+    case DBUS_TYPE_STRUCT:
+    case DBUS_TYPE_DICT_ENTRY:
+    case DBUS_STRUCT_BEGIN_CHAR:
+    case DBUS_DICT_ENTRY_BEGIN_CHAR:
+      return 8;
+    default:
+      return 1;
+  }
+}
+
+template <typename Element>
+constexpr std::size_t alignment_of() {
+  return alignment(element_signature<std::decay_t<Element>>::code[0]);
+}
+
+/// Appends values in native byte order to a buffer.
+/**
+ * Alignment is relative to the buffer's size when the writer was created,
+ * which has to be the start of a message for the result to be valid.
+ */
+class writer {
+ public:
+  explicit writer(std::string& out) : out_(out), start_(out.size()) {}
+
+  template <typename... Args>
+  bool write(const Args&... args) {
+    return (put(args) && ...);
+  }
+
+  void align(std::size_t n) {
+    std::size_t pad = (n - (out_.size() - start_) % n) % n;
+    out_.append(pad, '\0');
+  }
+
+  template <typename T>
+  void put_raw(T v) {
+    align(sizeof(T));
+    out_.append(reinterpret_cast<const char*>(&v), sizeof(T));
+  }
+
+  bool put_string(std::string_view s) {
+    if (s.find('\0') != std::string_view::npos) {
+      return false;
+    }
+    put_raw(static_cast<uint32>(s.size()));
+    out_.append(s.data(), s.size());
+    out_.push_back('\0');
+    return true;
+  }
+
+  bool put_signature(std::string_view s) {
+    if (s.size() > DBUS_MAXIMUM_SIGNATURE_LENGTH) {
+      return false;
+    }
+    out_.push_back(static_cast<char>(s.size()));
+    out_.append(s.data(), s.size());
+    out_.push_back('\0');
+    return true;
+  }
+
+  /// Position of an array's length and of its first element.
+  struct array_mark {
+    std::size_t length_at;
+    std::size_t start;
+  };
+
+  array_mark begin_array(std::size_t element_alignment) {
+    put_raw(uint32(0));
+    array_mark m{out_.size() - sizeof(uint32), 0};
+    align(element_alignment);
+    m.start = out_.size();
+    return m;
+  }
+
+  bool end_array(const array_mark& m) {
+    std::size_t length = out_.size() - m.start;
+    if (length > DBUS_MAXIMUM_ARRAY_LENGTH) {
+      return false;
+    }
+    uint32 l = static_cast<uint32>(length);
+    std::memcpy(&out_[m.length_at], &l, sizeof(l));
+    return true;
+  }
+
+  template <typename Element>
+  std::enable_if_t<is_fixed_type<Element>::value, bool> put(const Element& e) {
+    put_raw(e);
+    return true;
+  }
+
+  bool put(bool b) {
+    put_raw(uint32(b));
+    return true;
+  }
+
+  bool put(std::string_view s) { return put_string(s); }
+  bool put(const char* s) { return put_string(s); }
+  bool put(const string& s) { return put_string(s); }
+  bool put(const object_path& p) { return put_string(p.value); }
+  bool put(const object_path_view& p) { return put_string(p.value); }
+  bool put(const signature& s) { return put_signature(s.value); }
+  bool put(const signature_view& s) { return put_signature(s.value); }
+
+  bool put(const dbus_variant& v) {
+    return std::visit(
+        [this](const auto& val) {
+          static const constexpr auto sig =
+              element_signature<std::decay_t<decltype(val)>>::code;
+          return put_signature(sig.data()) && put(val);
+        },
+        v);
+  }
+
+  template <typename Key, typename Value>
+  bool put(const std::pair<Key, Value>& e) {
+    align(8);
+    return put(e.first) && put(e.second);
+  }
+
+  template <typename... Elements>
+  bool put(const std::tuple<Elements...>& e) {
+    align(8);
+    return std::apply([this](const auto&... v) { return write(v...); }, e);
+  }
+
+  template <typename Container>
+  std::enable_if_t<is_fixed_array<Container>::value, bool> put(
+      const Container& c) {
+    typedef std::remove_cv_t<typename Container::value_type> value_type;
+    array_mark m = begin_array(sizeof(value_type));
+    out_.append(reinterpret_cast<const char*>(c.data()),
+                c.size() * sizeof(value_type));
+    return end_array(m);
+  }
+
+  template <typename Container>
+  std::enable_if_t<has_const_iterator<Container>::value &&
+                       !is_string_type<Container>::value &&
+                       !is_fixed_array<Container>::value,
+                   bool>
+  put(const Container& c) {
+    array_mark m =
+        begin_array(alignment_of<typename Container::value_type>());
+    for (auto& element : c) {
+      if (!put(element)) {
+        return false;
+      }
+    }
+    return end_array(m);
+  }
+
+ private:
+  std::string& out_;
+  std::size_t start_;
+};
+
+/// Reads values from a buffer holding a message body.
+/**
+ * Every read is bounds checked, and containers may only be nested as deeply
+ * as the specification allows, so the buffer need not be trusted. Views
+ * point into the buffer; fixed array views are only available when the
+ * buffer is in native byte order and suitably aligned.
+ */
+class reader {
+ public:
+  reader(const char* data, std::size_t size, bool swap = false)
+      : data_(data), size_(size), pos_(0), swap_(swap) {}
+
+  template <typename... Args>
+  bool read(Args&... args) {
+    return (get(args) && ...);
+  }
+
+  bool at_end() const { return pos_ == size_; }
+
+  bool align(std::size_t n) {
+    std::size_t pad = (n - pos_ % n) % n;
+    if (pad > size_ - pos_) {
+      return false;
+    }
+    pos_ += pad;
+    return true;
+  }
+
+  template <typename T>
+  bool get_raw(T& v) {
+    if (!align(sizeof(T)) || sizeof(T) > size_ - pos_) {
+      return false;
+    }
+    std::memcpy(&v, data_ + pos_, sizeof(T));
+    if (swap_) {
+      swap_bytes(v);
+    }
+    pos_ += sizeof(T);
+    return true;
+  }
+
+  bool get_string(std::string_view& s) {
+    uint32 length;
+    if (!get_raw(length) || length >= size_ - pos_ ||
+        data_[pos_ + length] != '\0') {
+      return false;
+    }
+    s = std::string_view(data_ + pos_, length);
+    pos_ += length + 1;
+    return true;
+  }
+
+  bool get_signature(std::string_view& s) {
+    if (pos_ >= size_) {
+      return false;
+    }
+    std::size_t length = static_cast<unsigned char>(data_[pos_]);
+    if (length + 1 >= size_ - pos_ || data_[pos_ + 1 + length] != '\0') {
+      return false;
+    }
+    s = std::string_view(data_ + pos_ + 1, length);
+    pos_ += length + 2;
+    return true;
+  }
+
+  /// Step over one complete type, advancing sig past it.
+  bool skip(std::string_view& sig) { return skip(sig, nesting()); }
+
+  // Like message::unpack, a value of a type dbus_variant cannot hold is
+  // skipped, leaving v as it was.
+  bool get(dbus_variant& v) { return get(v, nesting()); }
+
+  template <typename Element>
+  std::enable_if_t<is_fixed_type<Element>::value, bool> get(Element& e) {
+    return get_raw(e);
+  }
+
+  bool get(bool& b) {
+    uint32 v;
+    if (!get_raw(v) || v > 1) {
+      return false;
+    }
+    b = v;
+    return true;
+  }
+
+  bool get(std::string_view& s) { return get_string(s); }
+  bool get(object_path_view& p) { return get_string(p.value); }
+  bool get(signature_view& s) { return get_signature(s.value); }
+
+  bool get(string& s) {
+    std::string_view v;
+    if (!get_string(v)) {
+      return false;
+    }
+    s.assign(v);
+    return true;
+  }
+
+  bool get(object_path& p) { return get(p.value); }
+
+  bool get(signature& s) {
+    std::string_view v;
+    if (!get_signature(v)) {
+      return false;
+    }
+    s.value.assign(v);
+    return true;
+  }
+
+  template <typename Key, typename Value>
+  bool get(std::pair<Key, Value>& e) {
+    return align(8) && get(e.first) && get(e.second);
+  }
+
+  template <typename... Elements>
+  bool get(std::tuple<Elements...>& e) {
+    return align(8) &&
+           std::apply([this](auto&... v) { return read(v...); }, e);
+  }
+
+  template <typename T>
+  std::enable_if_t<is_fixed_array_element<T>::value, bool> get(
+      array_view<T>& v) {
+    std::size_t begin, end;
+    if (swap_ || !get_array(alignof(T), begin, end) ||
+        reinterpret_cast<std::uintptr_t>(data_ + begin) % alignof(T) != 0) {
+      return false;
+    }
+    v = array_view<T>(reinterpret_cast<const T*>(data_ + begin),
+                      (end - begin) / sizeof(T));
+    pos_ = end;
+    return true;
+  }
+
+  template <typename Container>
+  std::enable_if_t<
+      message::unpacker::has_emplace_back_method<Container>::value &&
+          !is_string_type<Container>::value,
+      bool>
+  get(Container& c) {
+    typedef typename Container::value_type value_type;
+    std::size_t begin, end;
+    if (!get_array(alignment_of<value_type>(), begin, end)) {
+      return false;
+    }
+    if constexpr (is_fixed_array<Container>::value) {
+      if (!swap_) {
+        std::size_t n = (end - begin) / sizeof(value_type);
+        std::size_t old = c.size();
+        c.resize(old + n);
+        std::memcpy(c.data() + old, data_ + begin, n * sizeof(value_type));
+        pos_ = begin + n * sizeof(value_type);
+        return pos_ == end;
+      }
+    }
+    while (pos_ < end) {
+      c.emplace_back();
+      if (!get(c.back())) {
+        return false;
+      }
+    }
+    return pos_ == end;
+  }
+
+  template <typename Container>
+  std::enable_if_t<
+      message::unpacker::has_try_emplace_method<Container>::value, bool>
+  get(Container& c) {
+    std::size_t begin, end;
+    if (!get_array(8, begin, end)) {
+      return false;
+    }
+    while (pos_ < end) {
+      typename Container::key_type key;
+      if (!align(8) || !get(key)) {
+        return false;
+      }
+      auto inserted = c.try_emplace(std::move(key));
+      auto& value = inserted.first->second;
+      if (!inserted.second) {
+        message::unpacker::reset(value);
+      }
+      if (!get(value)) {
+        if (inserted.second) {
+          c.erase(inserted.first);
+        }
+        return false;
+      }
+    }
+    return pos_ == end;
+  }
+
+  template <typename Container>
+  std::enable_if_t<
+      message::unpacker::has_emplace_method<Container>::value &&
+          !message::unpacker::has_try_emplace_method<Container>::value &&
+          !is_string_type<Container>::value,
+      bool>
+  get(Container& c) {
+    typedef typename Container::value_type value_type;
+    std::size_t begin, end;
+    if (!get_array(alignment_of<value_type>(), begin, end)) {
+      return false;
+    }
+    while (pos_ < end) {
+      typename message::unpacker::mutable_value<value_type>::type t;
+      if (!get(t)) {
+        return false;
+      }
+      c.emplace(std::move(t));
+    }
+    return pos_ == end;
+  }
+
+ private:
+  // Containers enclosing the value being read. Arrays and structs
+  // (including dict entries) may each be nested
+  // DBUS_MAXIMUM_TYPE_RECURSION_DEPTH deep, and variants count towards twice
+  // that in total.
+  struct nesting {
+    unsigned arrays = 0;
+    unsigned structs = 0;
+    unsigned total = 0;
+
+    // Enter a container, false if that is nested too deeply.
+    bool enter(unsigned nesting::*kind) {
+      if (kind != nullptr &&
+          ++(this->*kind) > DBUS_MAXIMUM_TYPE_RECURSION_DEPTH) {
+        return false;
+      }
+      return ++total <= 2 * DBUS_MAXIMUM_TYPE_RECURSION_DEPTH;
+    }
+  };
+
+  // Step over one complete type nested in n.
+  bool skip(std::string_view& sig, nesting n) {
+    if (sig.empty()) {
+      return false;
+    }
+    char code = sig[0];
+    sig.remove_prefix(1);
+    std::string_view s;
+    switch (code) {
+      case DBUS_TYPE_BYTE:
+        return skip_bytes(1, 1);
+      case DBUS_TYPE_INT16:
+      case DBUS_TYPE_UINT16:
+        return skip_bytes(2, 2);
+      case DBUS_TYPE_BOOLEAN:
+      case DBUS_TYPE_INT32:
+      case DBUS_TYPE_UINT32:
+      case DBUS_TYPE_UNIX_FD:
+        return skip_bytes(4, 4);
+      case DBUS_TYPE_INT64:
+      case DBUS_TYPE_UINT64:
+      case DBUS_TYPE_DOUBLE:
+        return skip_bytes(8, 8);
+      case DBUS_TYPE_STRING:
+      case DBUS_TYPE_OBJECT_PATH:
+        return get_string(s);
+      case DBUS_TYPE_SIGNATURE:
+        return get_signature(s);
+      case DBUS_TYPE_VARIANT:
+        return n.enter(nullptr) && get_signature(s) && skip(s, n) &&
+               s.empty();
+      case DBUS_TYPE_ARRAY: {
+        uint32 length;
+        if (!n.enter(&nesting::arrays) || sig.empty() || !get_raw(length) ||
+            !align(alignment(sig[0])) || length > size_ - pos_) {
+          return false;
+        }
+        pos_ += length;
+        return skip_signature(sig, n);
+      }
+      case DBUS_STRUCT_BEGIN_CHAR:
+      case DBUS_DICT_ENTRY_BEGIN_CHAR: {
+        char end = code == DBUS_STRUCT_BEGIN_CHAR ? DBUS_STRUCT_END_CHAR
+                                                  : DBUS_DICT_ENTRY_END_CHAR;
+        if (!n.enter(&nesting::structs) || !align(8)) {
+          return false;
+        }
+        while (!sig.empty() && sig[0] != end) {
+          if (!skip(sig, n)) {
+            return false;
+          }
+        }
+        if (sig.empty()) {
+          return false;
+        }
+        sig.remove_prefix(1);
+        return true;
+      }
+      default:
+        return false;
+    }
+  }
+
+  // A variant nested in n; see get(dbus_variant&).
+  bool get(dbus_variant& v, nesting n) {
+    std::string_view sig;
+    if (!n.enter(nullptr) || !get_signature(sig)) {
+      return false;
+    }
+    bool found = false, ok = true;
+    if (sig.size() == 1) {
+      variant::for_each<dbus_variant>([&](auto t) {
+        if (!found && sig[0] == element<decltype(t)>::code) {
+          found = true;
+          ok = get(t);
+          if (ok) {
+            v = std::move(t);
+          }
+        }
+      });
+    }
+    if (found) {
+      return ok;
+    }
+    return skip(sig, n) && sig.empty();
+  }
+
+  bool skip_bytes(std::size_t alignment, std::size_t n) {
+    if (!align(alignment) || n > size_ - pos_) {
+      return false;
+    }
+    pos_ += n;
+    return true;
+  }
+
+  // Advance a signature past one complete type nested in n without reading
+  // data.
+  static bool skip_signature(std::string_view& sig, nesting n) {
+    if (sig.empty()) {
+      return false;
+    }
+    char code = sig[0];
+    sig.remove_prefix(1);
+    if (code == DBUS_TYPE_ARRAY) {
+      return n.enter(&nesting::arrays) && skip_signature(sig, n);
+    }
+    if (code == DBUS_STRUCT_BEGIN_CHAR || code == DBUS_DICT_ENTRY_BEGIN_CHAR) {
+      char end = code == DBUS_STRUCT_BEGIN_CHAR ? DBUS_STRUCT_END_CHAR
+                                                : DBUS_DICT_ENTRY_END_CHAR;
+      if (!n.enter(&nesting::structs)) {
+        return false;
+      }
+      while (!sig.empty() && sig[0] != end) {
+        if (!skip_signature(sig, n)) {
+          return false;
+        }
+      }
+      if (sig.empty()) {
+        return false;
+      }
+      sig.remove_prefix(1);
+    }
+    return true;
+  }
+
+  // Read an array's length and padding, giving the range of its elements.
+  bool get_array(std::size_t element_alignment, std::size_t& begin,
+                 std::size_t& end) {
+    uint32 length;
+    if (!get_raw(length) || !align(element_alignment) ||
+        length > size_ - pos_) {
+      return false;
+    }
+    begin = pos_;
+    end = pos_ + length;
+    return true;
+  }
+
+  const char* data_;
+  std::size_t size_;
+  std::size_t pos_;
+  bool swap_;
+};
+
+// Whether decoding into T would leave it pointing into the buffer.
+template <typename T, typename = void>
+struct borrows : std::integral_constant<
+                     bool, std::is_same<T, std::string_view>::value ||
+                               std::is_same<T, object_path_view>::value ||
+                               std::is_same<T, signature_view>::value> {};
+
+template <typename T>
+struct borrows<array_view<T>> : std::true_type {};
+
+template <typename Key, typename Value>
+struct borrows<std::pair<Key, Value>>
+    : std::integral_constant<bool, borrows<std::remove_cv_t<Key>>::value ||
+                                       borrows<Value>::value> {};
+
+template <typename... Elements>
+struct borrows<std::tuple<Elements...>>
+    : std::disjunction<borrows<Elements>...> {};
+
+template <typename Container>
+struct borrows<Container,
+               std::enable_if_t<has_const_iterator<Container>::value &&
+                                !is_string_type<Container>::value &&
+                                !is_fixed_array<Container>::value>>
+    : borrows<typename Container::value_type> {};
+
+/// Build a message with the header of another and a body encoded directly
+/// from args.
+/**
+ * The header's own body, if any, is ignored. The result is handed to libdbus
+ * through dbus_message_demarshal and is left without a serial, so sending it
+ * assigns one as usual.
+ *
+ * @return A null message if args could not be encoded.
+ */
+template <typename... Args>
+message marshal(message& header, const Args&... args) {
+  static const constexpr auto sig = args_signature<Args...>::code;
+
+  std::string out;
+  out.reserve(256);
+  writer w(out);
+  w.put(byte(native_byte_order()));
+  w.put(byte(dbus_message_get_type(header)));
+  byte flags = 0;
+  if (dbus_message_get_no_reply(header)) {
+    flags |= DBUS_HEADER_FLAG_NO_REPLY_EXPECTED;
+  }
+  if (!dbus_message_get_auto_start(header)) {
+    flags |= DBUS_HEADER_FLAG_NO_AUTO_START;
+  }
+  if (dbus_message_get_allow_interactive_authorization(header)) {
+    flags |= DBUS_HEADER_FLAG_ALLOW_INTERACTIVE_AUTHORIZATION;
+  }
+  w.put(flags);
+  w.put(byte(DBUS_MAJOR_PROTOCOL_VERSION));
+  const std::size_t body_length_at = out.size();
+  w.put(uint32(0));
+  // demarshalling rejects serial 0; cleared again below
+  w.put(uint32(1));
+
+  auto fields = w.begin_array(8);
+  auto field = [&](int code, char type, const char* value) {
+    if (value == NULL) {
+      return true;
+    }
+    w.align(8);
+    w.put(byte(code));
+    w.put_signature(std::string_view(&type, 1));
+    return type == DBUS_TYPE_SIGNATURE ? w.put_signature(value)
+                                       : w.put_string(value);
+  };
+  bool ok =
+      field(DBUS_HEADER_FIELD_PATH, DBUS_TYPE_OBJECT_PATH,
+            dbus_message_get_path(header)) &&
+      field(DBUS_HEADER_FIELD_INTERFACE, DBUS_TYPE_STRING,
+            dbus_message_get_interface(header)) &&
+      field(DBUS_HEADER_FIELD_MEMBER, DBUS_TYPE_STRING,
+            dbus_message_get_member(header)) &&
+      field(DBUS_HEADER_FIELD_ERROR_NAME, DBUS_TYPE_STRING,
+            dbus_message_get_error_name(header)) &&
+      field(DBUS_HEADER_FIELD_DESTINATION, DBUS_TYPE_STRING,
+            dbus_message_get_destination(header)) &&
+      field(DBUS_HEADER_FIELD_SENDER, DBUS_TYPE_STRING,
+            dbus_message_get_sender(header)) &&
+      (sizeof...(Args) == 0 ||
+       field(DBUS_HEADER_FIELD_SIGNATURE, DBUS_TYPE_SIGNATURE, sig.data()));
+  if (uint32 reply_serial = dbus_message_get_reply_serial(header)) {
+    w.align(8);
+    w.put(byte(DBUS_HEADER_FIELD_REPLY_SERIAL));
+    w.put_signature("u");
+    w.put(reply_serial);
+  }
+  if (!ok || !w.end_array(fields)) {
+    return message();
+  }
+  w.align(8);
+
+  const std::size_t body_start = out.size();
+  if (!w.write(args...)) {
+    return message();
+  }
+  uint32 body_length = static_cast<uint32>(out.size() - body_start);
+  std::memcpy(&out[body_length_at], &body_length, sizeof(body_length));
+
+  DBusMessage* m = dbus_message_demarshal(out.data(),
+                                          static_cast<int>(out.size()), NULL);
+  if (m == NULL) {
+    return message();
+  }
+  dbus_message_set_serial(m, 0);
+  message result(m);
+  dbus_message_unref(m);
+  return result;
+}
+
+/// Decode the whole body of a message directly from its wire format.
+/**
+ * Fails unless the body's signature is exactly that of args. The message is
+ * serialized into a temporary buffer, so borrowing targets such as
+ * std::string_view are not allowed; use a reader on a buffer you own.
+ */
+template <typename... Args>
+bool unmarshal(message& m, Args&... args) {
+  static_assert(!std::disjunction<borrows<Args>...>::value,
+                "unmarshal cannot fill views; they would outlive the buffer");
+  if (!m.has_signature<Args...>()) {
+    return false;
+  }
+  char* buffer;
+  int length;
+  if (!dbus_message_marshal(m, &buffer, &length)) {
+    return false;
+  }
+  std::unique_ptr<char, void (*)(void*)> guard(buffer, &dbus_free);
+
+  // fixed header, then the header fields array, padded to 8
+  uint32 fields_length;
+  std::memcpy(&fields_length, buffer + 12, sizeof(fields_length));
+  bool swap = buffer[0] != native_byte_order();
+  if (swap) {
+    swap_bytes(fields_length);
+  }
+  std::size_t body = (16 + std::size_t(fields_length) + 7) & ~std::size_t(7);
+  if (body > std::size_t(length)) {
+    return false;
+  }
+  reader r(buffer + body, length - body, swap);
+  return r.read(args...) && r.at_end();
+}
+
+}  // namespace wire
+}  // namespace dbus
+
+#endif  // DBUS_WIRE_HPP
@@ -6,9 +6,17 @@
 #include <dbus/connection.hpp>
 #include <dbus/endpoint.hpp>
 #include <dbus/filter.hpp>
+#include <dbus/match.hpp>
 #include <dbus/message.hpp>
 #include <functional>
+#include <atomic>
 #include <chrono>
+#include <future>
+#include <memory>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <vector>
 
 #include <unistd.h>
 #include <gmock/gmock.h>
@@ -80,3 +88,541 @@ TEST(ConnectionTest, CallWithExpiredTimeoutAndReplyCallback) {
       break;
   }
 }
+
+TEST(ConnectionTest, StrandSerializedThreadPool) {
+  constexpr auto srv_name = "com.test.strand_server";
+  constexpr auto srv_method = "echo";
+  constexpr int calls = 500;
+
+  asio::io_context io;
+  dbus::connection server(io, dbus::bus::session, dbus::threading::strand);
+  dbus::connection client(io, dbus::bus::session, dbus::threading::strand);
+
+  server.request_name(srv_name);
+
+  dbus::filter f(server, [] (dbus::message& m) { return m.get_member() == srv_method; });
+  std::function<void(asio::error_code, dbus::message)> on_call =
+      [&] (asio::error_code ec, dbus::message m) {
+        if (ec) return;
+        int32_t arg;
+        m.unpack(arg);
+        auto r = server.reply(m);
+        r.pack(arg);
+        server.async_send(r, [] (asio::error_code, dbus::message) {});
+        f.async_dispatch(on_call);
+      };
+  f.async_dispatch(on_call);
+
+  std::atomic<int> replies{0};
+  std::atomic<int> mismatches{0};
+  for (int32_t i = 0; i < calls; ++i) {
+    dbus::message m = dbus::message::new_call({srv_name, "/", srv_name, srv_method});
+    m.pack(i);
+    client.async_send(m, [&, i] (asio::error_code ec, dbus::message r) {
+      int32_t echoed = -1;
+      if (ec || !r.unpack(echoed) || echoed != i) ++mismatches;
+      if (++replies == calls) io.stop();
+    });
+  }
+
+  std::vector<std::thread> pool;
+  for (int t = 0; t < 4; ++t)
+    pool.emplace_back([&io] { io.run_for(10s); });
+  for (auto& t : pool) t.join();
+
+  EXPECT_EQ(replies, calls);
+  EXPECT_EQ(mismatches, 0);
+}
+
+TEST(ConnectionTest, DispatchBudget) {
+  constexpr auto srv_name = "com.test.budget_server";
+  constexpr int calls = 200;
+
+  asio::io_context io;
+  dbus::connection server(io, dbus::bus::session);
+  dbus::connection client(io, dbus::bus::session);
+
+  server.request_name(srv_name);
+  server.set_dispatch_budget(32);
+
+  int received = 0;
+  dbus::filter f(server, [] (dbus::message& m) { return m.get_member() == "ping"; });
+  std::function<void(asio::error_code, dbus::message)> on_call =
+      [&] (asio::error_code ec, dbus::message m) {
+        if (ec) return;
+        if (++received == calls) io.stop();
+        else f.async_dispatch(on_call);
+      };
+  f.async_dispatch(on_call);
+
+  for (int i = 0; i < calls; ++i) {
+    dbus::message m = dbus::message::new_call({srv_name, "/", srv_name, "ping"});
+    client.send(m, 0s);
+  }
+  client.flush();
+
+  io.run_for(10s);
+
+  auto stats = server.get_dispatch_stats();
+  EXPECT_EQ(received, calls);
+  EXPECT_GE(stats.messages, static_cast<std::uint64_t>(calls));
+  EXPECT_LE(stats.max_batch, 32u);
+  EXPECT_GT(stats.max_batch, 1u);
+  EXPECT_LT(stats.runs, stats.messages);
+}
+
+TEST(ConnectionTest, PendingCallTimeoutAndAbort) {
+  constexpr auto srv_name = "com.test.silent_server";
+
+  asio::io_context io;
+  dbus::connection server(io, dbus::bus::session);
+  server.request_name(srv_name);
+
+  // swallow every call without replying
+  dbus::filter f(server, [] (dbus::message& m) { return m.get_member() == "ignore"; });
+  std::function<void(asio::error_code, dbus::message)> on_call =
+      [&] (asio::error_code, dbus::message) { f.async_dispatch(on_call); };
+  f.async_dispatch(on_call);
+
+  asio::error_code timed_out, aborted;
+  std::string error_name;
+  {
+    dbus::connection client(io, dbus::bus::session);
+
+    dbus::message m1 = dbus::message::new_call({srv_name, "/", srv_name, "ignore"});
+    client.async_send(m1, [&] (asio::error_code ec, dbus::message r) {
+      timed_out = ec;
+      error_name = dbus_message_get_error_name(r);
+    }, 50);
+
+    dbus::message m2 = dbus::message::new_call({srv_name, "/", srv_name, "ignore"});
+    client.async_send(m2, [&] (asio::error_code ec, dbus::message) {
+      aborted = ec;
+    });
+
+    io.run_for(200ms);
+    io.restart();
+  }
+  io.run_for(50ms);
+
+  EXPECT_TRUE(timed_out);
+  EXPECT_EQ(error_name, DBUS_ERROR_NO_REPLY);
+  EXPECT_EQ(aborted, asio::error::operation_aborted);
+}
+
+#if defined(DBUS_HAS_CANCELLATION_SLOTS)
+TEST(ConnectionTest, PerOperationCancellation) {
+  constexpr auto srv_name = "com.test.cancel_server";
+
+  asio::io_context io;
+  dbus::connection server(io, dbus::bus::session);
+  dbus::connection client(io, dbus::bus::session);
+  server.request_name(srv_name);
+
+  // swallow every call without replying
+  dbus::filter f(server, [] (dbus::message& m) { return m.get_member() == "ignore"; });
+  std::function<void(asio::error_code, dbus::message)> on_call =
+      [&] (asio::error_code, dbus::message) { f.async_dispatch(on_call); };
+  f.async_dispatch(on_call);
+
+  asio::cancellation_signal send_cancel, call_cancel, dispatch_cancel;
+  asio::error_code send_ec, call_ec, dispatch_ec;
+
+  dbus::message m = dbus::message::new_call({srv_name, "/", srv_name, "ignore"});
+  client.async_send(m, asio::bind_cancellation_slot(send_cancel.slot(),
+      [&] (asio::error_code ec, dbus::message) { send_ec = ec; }));
+
+  client.async_method_call(
+      asio::bind_cancellation_slot(call_cancel.slot(),
+          [&] (asio::error_code ec, int32_t) { call_ec = ec; }),
+      dbus::endpoint(srv_name, "/", srv_name, "ignore"));
+
+  dbus::filter never(client, [] (dbus::message& m) { return m.get_member() == "never"; });
+  never.async_dispatch(asio::bind_cancellation_slot(dispatch_cancel.slot(),
+      [&] (asio::error_code ec, dbus::message) { dispatch_ec = ec; }));
+
+  asio::steady_timer t(io, 50ms);
+  t.async_wait([&] (const asio::error_code&) {
+    send_cancel.emit(asio::cancellation_type::terminal);
+    call_cancel.emit(asio::cancellation_type::terminal);
+    dispatch_cancel.emit(asio::cancellation_type::terminal);
+  });
+
+  io.run_for(200ms);
+
+  EXPECT_EQ(send_ec, asio::error::operation_aborted);
+  EXPECT_EQ(call_ec, asio::error::operation_aborted);
+  EXPECT_EQ(dispatch_ec, asio::error::operation_aborted);
+}
+#endif
+
+TEST(ConnectionTest, AsyncMethodCallCompletionToken) {
+  asio::io_context io;
+  dbus::connection bus(io, dbus::bus::session);
+  auto work = asio::make_work_guard(io);
+  std::thread t([&] { io.run(); });
+
+  dbus::endpoint owner("org.freedesktop.DBus", "/org/freedesktop/DBus",
+                       "org.freedesktop.DBus", "GetNameOwner");
+
+  std::future<std::tuple<std::string>> f =
+      bus.async_method_call<std::string>(owner, bus.get_unique_name(),
+                                         asio::use_future);
+  EXPECT_EQ(std::get<0>(f.get()), bus.get_unique_name());
+
+  // a reply that does not unpack into the requested types
+  std::future<std::tuple<int32_t>> bad = bus.async_method_call<int32_t>(
+      owner, bus.get_unique_name(), asio::use_future);
+  try {
+    bad.get();
+    ADD_FAILURE() << "expected invalid_argument";
+  } catch (const asio::system_error& e) {
+    EXPECT_EQ(e.code(), asio::error::invalid_argument);
+  }
+
+  work.reset();
+  io.stop();
+  t.join();
+}
+
+#if defined(ASIO_HAS_CO_AWAIT)
+TEST(ConnectionTest, AsyncMethodCallCoroutine) {
+  asio::io_context io;
+  dbus::connection bus(io, dbus::bus::session);
+
+  dbus::endpoint pid("org.freedesktop.DBus", "/org/freedesktop/DBus",
+                     "org.freedesktop.DBus", "GetConnectionUnixProcessID");
+
+  uint32_t result = 0;
+  asio::co_spawn(
+      io,
+      [&]() -> asio::awaitable<void> {
+        std::tuple<uint32_t> r = co_await bus.async_method_call<uint32_t>(
+            pid, bus.get_unique_name(), asio::use_awaitable);
+        result = std::get<0>(r);
+        io.stop();
+      },
+      asio::detached);
+
+  io.run_for(5s);
+  EXPECT_EQ(result, static_cast<uint32_t>(getpid()));
+}
+#endif
+
+TEST(ConnectionTest, AsyncNameManagement) {
+  asio::io_context io;
+  dbus::connection bus(io, dbus::bus::session);
+  dbus::connection other(io, dbus::bus::session);
+
+  std::uint32_t requested = 0, released = 0;
+  int done = 0;
+  bus.async_request_name("com.test.async_name",
+                         [&](asio::error_code ec, std::uint32_t code) {
+                           EXPECT_FALSE(ec);
+                           requested = code;
+                           // move-only handlers are moved through
+                           auto owned = std::make_unique<int>(3);
+                           bus.async_release_name(
+                               "com.test.async_name",
+                               [&, owned = std::move(owned)](
+                                   asio::error_code ec, std::uint32_t code) {
+                                 EXPECT_FALSE(ec);
+                                 released = code;
+                                 if (++done == *owned) io.stop();
+                               });
+                         });
+
+  std::vector<std::string> names = {"com.test.batch_a", "com.test.batch_b",
+                                    "com.test.batch_c"};
+  std::vector<std::uint32_t> batch;
+  bus.async_request_names(
+      names, [&](asio::error_code ec, std::vector<std::uint32_t> codes) {
+        EXPECT_FALSE(ec);
+        batch = std::move(codes);
+        // the names are taken and may not be replaced
+        other.async_request_names(
+            names, DBUS_NAME_FLAG_DO_NOT_QUEUE,
+            [&](asio::error_code ec, std::vector<std::uint32_t> codes) {
+              EXPECT_FALSE(ec);
+              EXPECT_EQ(codes, std::vector<std::uint32_t>(
+                                   3, DBUS_REQUEST_NAME_REPLY_EXISTS));
+              if (++done == 3) io.stop();
+            });
+      });
+
+  // an invalid name fails without affecting the rest of the batch
+  asio::error_code invalid;
+  std::vector<std::uint32_t> partial;
+  other.async_request_names(
+      {"com.test.batch_d", "not a name"},
+      [&](asio::error_code ec, std::vector<std::uint32_t> codes) {
+        invalid = ec;
+        partial = std::move(codes);
+        if (++done == 3) io.stop();
+      });
+
+  io.run_for(5s);
+
+  EXPECT_EQ(requested,
+            static_cast<std::uint32_t>(DBUS_REQUEST_NAME_REPLY_PRIMARY_OWNER));
+  EXPECT_EQ(released,
+            static_cast<std::uint32_t>(DBUS_RELEASE_NAME_REPLY_RELEASED));
+  EXPECT_EQ(batch, std::vector<std::uint32_t>(
+                       3, DBUS_REQUEST_NAME_REPLY_PRIMARY_OWNER));
+  EXPECT_TRUE(invalid);
+  EXPECT_EQ(partial, (std::vector<std::uint32_t>{
+                         DBUS_REQUEST_NAME_REPLY_PRIMARY_OWNER, 0}));
+}
+
+TEST(ConnectionTest, RouterPicksEarliestSubscriber) {
+  asio::io_context io;
+  dbus::detail::dispatch_context ctx(io, false);
+  dbus::detail::router router;
+  dbus::detail::queue<dbus::message> q(ctx);
+
+  auto make = [&](dbus::route r) {
+    auto e = std::make_unique<dbus::detail::router::entry>();
+    e->r = std::move(r);
+    e->target = &q;
+    return e;
+  };
+  auto by_member = make({dbus::message_type::signal, "org.test", "Changed"});
+  auto by_prefix = make({dbus::message_type::invalid, "", "", "", "/org/test"});
+  auto by_path = make({dbus::message_type::signal, "", "", "/org/test/a"});
+  auto anything = std::make_unique<dbus::detail::router::entry>();
+  anything->predicate = [](dbus::message&) { return true; };
+  anything->target = &q;
+
+  router.add(*by_prefix);
+  router.add(*by_member);
+  router.add(*by_path);
+
+  auto signal = [](const char* path, const char* member) {
+    return dbus::message::new_signal(dbus::endpoint("", path, "org.test"),
+                                     member);
+  };
+  dbus::message m = signal("/org/test/a", "Changed");
+  EXPECT_EQ(router.find(m), by_prefix.get());
+  m = signal("/org/tests", "Changed");
+  EXPECT_EQ(router.find(m), by_member.get());
+  m = signal("/org/tests", "Other");
+  EXPECT_EQ(router.find(m), nullptr);
+
+  router.remove(*by_prefix);
+  m = signal("/org/test/a", "Other");
+  EXPECT_EQ(router.find(m), by_path.get());
+
+  // a predicate registered later only gets what the routes leave
+  router.add(*anything);
+  EXPECT_EQ(router.find(m), by_path.get());
+  m = signal("/org/test/b", "Other");
+  EXPECT_EQ(router.find(m), anything.get());
+}
+
+TEST(ConnectionTest, RoutedFilter) {
+  constexpr auto srv_name = "com.test.routed_server";
+
+  asio::io_context io;
+  dbus::connection server(io, dbus::bus::session);
+  dbus::connection client(io, dbus::bus::session);
+  server.request_name(srv_name);
+
+  dbus::filter f(server, dbus::route{dbus::message_type::method_call,
+                                     srv_name, "Routed", "", "/a"});
+  std::string path;
+  f.async_dispatch([&](asio::error_code ec, dbus::message m) {
+    EXPECT_FALSE(ec);
+    path = m.get_path();
+    io.stop();
+  });
+
+  // outside the path namespace
+  dbus::message m = dbus::message::new_call({srv_name, "/b", srv_name, "Routed"});
+  client.send(m, 0s);
+  m = dbus::message::new_call({srv_name, "/a/b", srv_name, "Routed"});
+  client.send(m, 0s);
+  client.flush();
+
+  io.run_for(5s);
+  EXPECT_EQ(path, "/a/b");
+}
+
+TEST(ConnectionTest, QueueHandsOffAcrossThreads) {
+  constexpr int producers = 4;
+  constexpr int per_producer = 10000;
+
+  asio::io_context io;
+  auto work = asio::make_work_guard(io);
+  dbus::detail::dispatch_context ctx(io, false);
+  dbus::detail::queue<int> q(ctx);
+
+  std::atomic<int> received(0);
+  std::atomic<long long> sum(0);
+  std::function<void(asio::error_code, int)> on_pop =
+      [&](asio::error_code ec, int value) {
+        EXPECT_FALSE(ec);
+        sum += value;
+        if (++received == producers * per_producer) {
+          io.stop();
+        } else {
+          q.async_pop(on_pop);
+        }
+      };
+  q.async_pop(on_pop);
+  q.async_pop(on_pop);
+
+  std::vector<std::thread> threads;
+  for (int i = 0; i < 2; ++i) threads.emplace_back([&] { io.run(); });
+  for (int i = 0; i < producers; ++i) {
+    threads.emplace_back([&, i] {
+      for (int j = 0; j < per_producer; ++j) q.push(i * per_producer + j);
+    });
+  }
+  for (auto& t : threads) t.join();
+
+  // every message is delivered exactly once
+  long long n = producers * per_producer;
+  EXPECT_EQ(received, n);
+  EXPECT_EQ(sum, n * (n - 1) / 2);
+}
+
+#if defined(DBUS_HAS_CANCELLATION_SLOTS)
+TEST(ConnectionTest, CancelAfterQueueDestroyed) {
+  asio::io_context io;
+  dbus::detail::dispatch_context ctx(io, false);
+  auto q = std::make_unique<dbus::detail::queue<int>>(ctx);
+
+  asio::cancellation_signal cancel;
+  asio::error_code ec = asio::error::would_block;
+  int value = 0;
+  q->async_pop(asio::bind_cancellation_slot(
+      cancel.slot(), [&](asio::error_code e, int v) {
+        ec = e;
+        value = v;
+      }));
+  // completed, but not run before the queue goes away
+  q->push(42);
+  q.reset();
+  cancel.emit(asio::cancellation_type::terminal);
+
+  io.poll();
+  EXPECT_FALSE(ec);
+  EXPECT_EQ(value, 42);
+}
+#endif
+
+TEST(ConnectionTest, BoundedQueueOverflow) {
+  asio::io_context io;
+  dbus::detail::dispatch_context ctx(io, false);
+
+  auto signal = [](const char* member, dbus::int32 n) {
+    dbus::message m = dbus::message::new_signal(
+        dbus::endpoint("", "/org/test", "org.test"), member);
+    m.pack(n);
+    return m;
+  };
+  // pop everything buffered, as the values packed in the messages
+  auto drain = [&](dbus::detail::queue<dbus::message>& q) {
+    std::vector<dbus::int32> values;
+    std::size_t errors = 0;
+    for (std::size_t i = q.get_stats().buffered + 1; i > 0; --i) {
+      q.async_pop([&](asio::error_code ec, dbus::message m) {
+        if (ec) {
+          ++errors;
+        } else {
+          dbus::int32 n;
+          m.unpack(n);
+          values.push_back(n);
+        }
+      });
+    }
+    io.restart();
+    io.poll();
+    values.push_back(-static_cast<dbus::int32>(errors));
+    return values;
+  };
+
+  dbus::detail::queue<dbus::message> oldest(ctx);
+  oldest.set_limit(2, dbus::overflow_policy::drop_oldest);
+  for (int i = 0; i < 5; ++i) oldest.push(signal("A", i));
+  auto stats = oldest.get_stats();
+  EXPECT_EQ(stats.buffered, 2u);
+  EXPECT_EQ(stats.high_water_mark, 2u);
+  EXPECT_EQ(stats.dropped, 3u);
+  EXPECT_EQ(drain(oldest), (std::vector<dbus::int32>{3, 4, 0}));
+
+  dbus::detail::queue<dbus::message> newest(ctx);
+  newest.set_limit(2, dbus::overflow_policy::drop_newest);
+  for (int i = 0; i < 5; ++i) newest.push(signal("A", i));
+  EXPECT_EQ(drain(newest), (std::vector<dbus::int32>{0, 1, 0}));
+
+  dbus::detail::queue<dbus::message> coalesce(ctx);
+  coalesce.set_limit(2, dbus::overflow_policy::coalesce);
+  coalesce.push(signal("A", 0));
+  coalesce.push(signal("B", 1));
+  coalesce.push(signal("A", 2));  // replaces A 0
+  coalesce.push(signal("C", 3));  // nothing to coalesce with: drops A 2
+  EXPECT_EQ(coalesce.get_stats().coalesced, 1u);
+  EXPECT_EQ(coalesce.get_stats().dropped, 1u);
+  EXPECT_EQ(drain(coalesce), (std::vector<dbus::int32>{1, 3, 0}));
+
+  dbus::detail::queue<dbus::message> report(ctx);
+  report.set_limit(1, dbus::overflow_policy::report);
+  for (int i = 0; i < 3; ++i) report.push(signal("A", i));
+  // the error comes first, then what was kept
+  EXPECT_EQ(drain(report), (std::vector<dbus::int32>{0, -1}));
+}
+
+TEST(ConnectionTest, QueueSubscription) {
+  asio::io_context io;
+  dbus::detail::dispatch_context ctx(io, false);
+  dbus::detail::queue<int> q(ctx);
+
+  std::vector<int> received;
+  std::size_t errors = 0;
+  auto s = std::make_shared<dbus::detail::queue<int>::subscriber>(
+      [&](asio::error_code ec, int value) {
+        if (ec)
+          ++errors;
+        else
+          received.push_back(value);
+      });
+  q.push(0);
+  q.push(1);
+  q.subscribe(s);
+  for (int i = 2; i < 5; ++i) q.push(i);
+  io.poll();
+  // buffered messages first, then each one pushed, with a single handler
+  EXPECT_EQ(received, (std::vector<int>{0, 1, 2, 3, 4}));
+  EXPECT_EQ(q.get_stats().buffered, 0u);
+
+  // messages wait in the buffer, under its limit, until they are delivered
+  q.set_limit(2, dbus::overflow_policy::drop_oldest);
+  for (int i = 5; i < 10; ++i) q.push(i);
+  EXPECT_EQ(q.get_stats().buffered, 2u);
+  EXPECT_EQ(q.get_stats().dropped, 3u);
+  io.restart();
+  io.poll();
+  EXPECT_EQ(received, (std::vector<int>{0, 1, 2, 3, 4, 8, 9}));
+
+  q.set_limit(1, dbus::overflow_policy::report);
+  q.push(10);
+  q.push(11);
+  io.restart();
+  io.poll();
+  EXPECT_EQ(errors, 1u);
+  EXPECT_EQ(received.back(), 10);
+
+  // what the subscriber has not been called with stays for async_pop
+  q.push(12);
+  q.subscribe(nullptr);
+  io.restart();
+  io.poll();
+  EXPECT_EQ(received.back(), 10);
+  EXPECT_EQ(q.get_stats().buffered, 1u);
+  int popped = 0;
+  q.async_pop([&](asio::error_code, int value) { popped = value; });
+  io.restart();
+  io.poll();
+  EXPECT_EQ(popped, 12);
+}
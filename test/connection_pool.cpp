@@ -0,0 +1,101 @@
+// Copyright (c) Benjamin Kietzman (github.com/bkietz)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+#include <dbus/connection.hpp>
+#include <dbus/connection_pool.hpp>
+#include <dbus/endpoint.hpp>
+#include <dbus/filter.hpp>
+#include <dbus/match.hpp>
+#include <dbus/message.hpp>
+#include <chrono>
+#include <functional>
+#include <set>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+using namespace std::literals;
+
+TEST(ConnectionPoolTest, SelectByDestination) {
+  asio::io_context io;
+  dbus::connection_pool pool(io, dbus::bus::session, 4);
+  ASSERT_EQ(pool.size(), 4u);
+
+  auto& first = pool.select("com.test.a");
+  for (int i = 0; i < 10; ++i) {
+    EXPECT_EQ(&pool.select("com.test.a"), &first);
+  }
+}
+
+TEST(ConnectionPoolTest, SelectRoundRobin) {
+  asio::io_context io;
+  dbus::connection_pool pool(io, dbus::bus::session, 3,
+                             dbus::connection_pool::policy::round_robin);
+
+  std::set<dbus::connection*> used;
+  for (int i = 0; i < 3; ++i) {
+    used.insert(&pool.select("com.test.a"));
+  }
+  EXPECT_EQ(used.size(), 3u);
+}
+
+TEST(ConnectionPoolTest, RejectsEmptyPool) {
+  asio::io_context io;
+  EXPECT_THROW(dbus::connection_pool(io, dbus::bus::session, 0),
+               asio::system_error);
+  EXPECT_THROW(dbus::connection_pool({}, dbus::bus::session),
+               asio::system_error);
+}
+
+TEST(ConnectionPoolTest, MethodCallsAcrossIoContexts) {
+  constexpr auto srv_name = "com.test.pool_server";
+  constexpr int calls = 300;
+
+  asio::io_context server_io;
+  dbus::connection server(server_io, dbus::bus::session);
+  server.request_name(srv_name);
+
+  dbus::filter f(server, [] (dbus::message& m) { return m.get_member() == "add"; });
+  std::function<void(asio::error_code, dbus::message)> on_call =
+      [&] (asio::error_code ec, dbus::message m) {
+        if (ec) return;
+        int32_t a, b;
+        m.unpack(a, b);
+        auto r = server.reply(m);
+        r.pack(a + b);
+        server.async_send(r, [] (asio::error_code, dbus::message) {});
+        f.async_dispatch(on_call);
+      };
+  f.async_dispatch(on_call);
+
+  asio::io_context io1, io2;
+  dbus::connection_pool pool({io1, io2}, dbus::bus::session,
+                             dbus::connection_pool::policy::round_robin);
+
+  std::atomic<int> replies{0};
+  std::atomic<int> errors{0};
+  for (int32_t i = 0; i < calls; ++i) {
+    pool.async_method_call(
+        [&, i] (asio::error_code ec, int32_t sum) {
+          if (ec || sum != i + 1) ++errors;
+          if (++replies == calls) {
+            io1.stop();
+            io2.stop();
+            server_io.stop();
+          }
+        },
+        dbus::endpoint(srv_name, "/", srv_name, "add"), i, int32_t(1));
+  }
+
+  std::thread t1([&io1] { io1.run_for(10s); });
+  std::thread t2([&io2] { io2.run_for(10s); });
+  server_io.run_for(10s);
+  t1.join();
+  t2.join();
+
+  EXPECT_EQ(replies, calls);
+  EXPECT_EQ(errors, 0);
+}
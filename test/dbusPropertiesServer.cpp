@@ -372,3 +372,64 @@ TEST(DbusPropertiesInterface, PropertiesInterface) {
 
   io.run();
 }
+
+TEST(DbusPropertiesInterface, ObjectPathDispatch) {
+  asio::io_context io;
+  dbus::connection bus(io, dbus::bus::session);
+
+  dbus::DbusObjectServer foo(bus);
+  auto leaf = std::make_shared<dbus::DbusObject>(bus, "/org/test/leaf");
+  auto tree = std::make_shared<dbus::DbusObject>(bus, "/org/test/tree");
+  foo.register_object(leaf);
+  foo.register_fallback(tree);
+
+  auto iface = std::make_shared<dbus::DbusInterface>("org.test.Doubler", bus);
+  leaf->register_interface(iface);
+  tree->register_interface(iface);
+  int calls = 0;
+  iface->register_method("Double", [&calls](int32_t x) {
+    ++calls;
+    return 2 * x;
+  });
+
+  // a signal with the interface and member of a method is not a call
+  dbus::message s = dbus::message::new_signal(
+      dbus::endpoint("", "/org/test/leaf", "org.test.Doubler"), "Double");
+  s.set_destination(bus.get_unique_name());
+  s.pack(int32_t(21));
+  bus.async_send(s, [](asio::error_code, dbus::message) {});
+
+  std::vector<std::string> paths{"/org/test/leaf", "/org/test/tree/a/b",
+                                 "/org/test/leaf/a", "/org/test/none"};
+  std::vector<asio::error_code> errors(paths.size());
+  std::vector<int32_t> results(paths.size());
+  size_t outstanding_async_calls = paths.size();
+  for (size_t i = 0; i < paths.size(); ++i) {
+    bus.async_method_call(
+        [&, i](const asio::error_code ec, int32_t value) {
+          errors[i] = ec;
+          results[i] = value;
+          if (--outstanding_async_calls == 0) {
+            io.stop();
+          }
+        },
+        dbus::endpoint(bus.get_unique_name(), paths[i], "org.test.Doubler",
+                       "Double"),
+        int32_t(21));
+  }
+
+  io.run_for(std::chrono::seconds(5));
+  EXPECT_EQ(outstanding_async_calls, 0u);
+  EXPECT_FALSE(errors[0]);
+  EXPECT_EQ(results[0], 42);
+  // only a fallback serves the paths below it
+  EXPECT_FALSE(errors[1]);
+  EXPECT_EQ(results[1], 42);
+  // libdbus answers calls no object takes with an error
+  EXPECT_TRUE(errors[2]);
+  EXPECT_TRUE(errors[3]);
+  EXPECT_EQ(calls, 2);
+
+  foo.remove_object(leaf);
+  EXPECT_NO_THROW(foo.register_object(leaf));
+}
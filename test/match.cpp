@@ -0,0 +1,295 @@
+// Copyright (c) Benjamin Kietzman (github.com/bkietz)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+#include <dbus/connection.hpp>
+#include <dbus/endpoint.hpp>
+#include <dbus/filter.hpp>
+#include <dbus/match.hpp>
+#include <dbus/message.hpp>
+#include <dbus/signal_hub.hpp>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+using namespace std::literals;
+
+namespace {
+
+const char* test_interface = "com.test.match";
+
+void emit(dbus::connection& c, const std::string& member) {
+  dbus::message s = dbus::message::new_signal(
+      dbus::endpoint("", "/com/test/match", test_interface), member);
+  c.async_send(s, [](asio::error_code, dbus::message) {});
+}
+
+std::string rule_for(const std::string& member) {
+  return "type='signal',interface='" + std::string(test_interface) +
+         "',member='" + member + "'";
+}
+
+}  // namespace
+
+TEST(MatchTest, AsyncConstruction) {
+  asio::io_context io;
+  dbus::connection listener(io, dbus::bus::session);
+  dbus::connection emitter(io, dbus::bus::session);
+
+  dbus::filter f(listener, [](dbus::message& m) {
+    return m.get_interface() == test_interface;
+  });
+
+  std::string received;
+  f.async_dispatch([&](asio::error_code ec, dbus::message m) {
+    EXPECT_FALSE(ec);
+    received = m.get_member();
+    io.stop();
+  });
+
+  asio::error_code installed = asio::error::would_block;
+  dbus::match m(listener, rule_for("Async"), [&](asio::error_code ec) {
+    installed = ec;
+    emit(emitter, "Async");
+  });
+
+  io.run_for(5s);
+  EXPECT_FALSE(installed);
+  EXPECT_EQ(received, "Async");
+}
+
+TEST(MatchTest, MatchSetBatches) {
+  asio::io_context io;
+  dbus::connection listener(io, dbus::bus::session);
+  dbus::connection emitter(io, dbus::bus::session);
+
+  dbus::filter f(listener, [](dbus::message& m) {
+    return m.get_interface() == test_interface;
+  });
+
+  std::vector<std::string> rules;
+  for (int i = 0; i < 100; ++i) {
+    rules.push_back(rule_for("Sig" + std::to_string(i)));
+  }
+
+  dbus::match_set set(listener);
+  asio::error_code added = asio::error::would_block;
+  asio::error_code removed = asio::error::would_block;
+  std::string received;
+
+  set.async_add(rules, [&](asio::error_code ec) {
+    added = ec;
+    emit(emitter, "Sig42");
+  });
+  f.async_dispatch([&](asio::error_code ec, dbus::message m) {
+    received = m.get_member();
+    set.async_remove(rules, [&](asio::error_code ec) {
+      removed = ec;
+      io.stop();
+    });
+  });
+
+  io.run_for(5s);
+  EXPECT_FALSE(added);
+  EXPECT_FALSE(removed);
+  EXPECT_EQ(received, "Sig42");
+  EXPECT_EQ(set.size(), 0u);
+
+  // one bad rule fails the batch, but the others are still installed
+  asio::error_code bad;
+  set.async_add({rule_for("Good"), "this is not a rule"},
+                [&](asio::error_code ec) {
+                  bad = ec;
+                  io.stop();
+                });
+  io.restart();
+  io.run_for(5s);
+  EXPECT_TRUE(bad);
+  EXPECT_TRUE(set.contains(rule_for("Good")));
+  // the rejected rule is not kept, so adding it again is not skipped
+  EXPECT_FALSE(set.contains("this is not a rule"));
+  EXPECT_EQ(set.size(), 1u);
+  EXPECT_EQ(listener.get_match_rules().size(), 1u);
+
+  asio::error_code retried;
+  set.async_add({"this is not a rule"}, [&](asio::error_code ec) {
+    retried = ec;
+    io.stop();
+  });
+  io.restart();
+  io.run_for(5s);
+  EXPECT_TRUE(retried);
+  EXPECT_EQ(set.size(), 1u);
+}
+
+TEST(MatchTest, NormalizeRule) {
+  using dbus::detail::match_registry;
+  EXPECT_EQ(match_registry::normalize("type='signal',interface='a.b'"),
+            "interface='a.b',type='signal'");
+  EXPECT_EQ(match_registry::normalize(" interface='a.b',  type=signal"),
+            "interface='a.b',type='signal'");
+  EXPECT_EQ(match_registry::normalize("arg0='it'\\''s'"), "arg0='it'\\''s'");
+  EXPECT_EQ(match_registry::normalize("arg0=it\\'s"), "arg0='it'\\''s'");
+  // unparseable rules are left for the bus daemon to reject
+  EXPECT_EQ(match_registry::normalize("this is not a rule"),
+            "this is not a rule");
+  EXPECT_EQ(match_registry::normalize("type='signal',type='error'"),
+            "type='signal',type='error'");
+}
+
+TEST(MatchTest, RegistryDeduplicates) {
+  asio::io_context io;
+  dbus::connection listener(io, dbus::bus::session);
+  dbus::connection emitter(io, dbus::bus::session);
+
+  dbus::filter f(listener, [](dbus::message& m) {
+    return m.get_interface() == test_interface;
+  });
+
+  std::string key = dbus::detail::match_registry::normalize(rule_for("Dup"));
+  auto first = std::make_unique<dbus::match>(listener, rule_for("Dup"));
+  dbus::match second(listener, "member='Dup', interface='" +
+                                   std::string(test_interface) +
+                                   "', type='signal'");
+  EXPECT_EQ(second.get_key(), key);
+
+  dbus::match_set set(listener);
+  asio::error_code added = asio::error::would_block;
+  set.async_add({rule_for("Dup")}, [&](asio::error_code ec) { added = ec; });
+  io.poll();
+  EXPECT_FALSE(added);
+
+  auto rules = listener.get_match_rules();
+  ASSERT_EQ(rules.size(), 1u);
+  EXPECT_EQ(rules[0].rule, key);
+  EXPECT_EQ(rules[0].subscribers, 3u);
+  EXPECT_TRUE(rules[0].acknowledged);
+
+  // the rule stays installed while anyone holds it
+  first.reset();
+  // handlers only need to be movable
+  set.async_remove({rule_for("Dup")},
+                   [owned = std::make_unique<int>()](asio::error_code) {});
+  ASSERT_EQ(listener.get_match_rules().size(), 1u);
+  EXPECT_EQ(listener.get_match_rules()[0].subscribers, 1u);
+
+  std::string received;
+  f.async_dispatch([&](asio::error_code ec, dbus::message m) {
+    EXPECT_FALSE(ec);
+    received = m.get_member();
+    io.stop();
+  });
+  emit(emitter, "Dup");
+  io.run_for(5s);
+  EXPECT_EQ(received, "Dup");
+}
+
+TEST(MatchTest, BlockingMatchBehindPendingRule) {
+  asio::io_context io;
+  dbus::connection listener(io, dbus::bus::session);
+  dbus::connection emitter(io, dbus::bus::session);
+
+  // the io_context is not running yet, so the asynchronous AddMatch cannot
+  // be answered before the blocking match returns
+  asio::error_code installed = asio::error::would_block;
+  {
+    dbus::match pending(listener, rule_for("Pending"),
+                        [&, owned = std::make_unique<int>()](
+                            asio::error_code ec) {
+                          installed = ec;
+                          io.stop();
+                        });
+    dbus::match shared(listener, rule_for("Pending"));
+    auto rules = listener.get_match_rules();
+    ASSERT_EQ(rules.size(), 1u);
+    EXPECT_EQ(rules[0].subscribers, 2u);
+
+    dbus::match rejected(listener, "this is not a rule",
+                         [](asio::error_code) {});
+    EXPECT_THROW(dbus::match(listener, "this is not a rule"),
+                 asio::system_error);
+    // the failed match gave its reference back
+    EXPECT_EQ(listener.get_match_rules().back().subscribers, 1u);
+
+    io.run_for(5s);
+    EXPECT_FALSE(installed);
+  }
+  EXPECT_TRUE(listener.get_match_rules().empty());
+
+  // both AddMatch calls were undone, so only the second signal arrives
+  dbus::filter f(listener, [](dbus::message& m) {
+    return m.get_interface() == test_interface;
+  });
+  std::string received;
+  f.async_dispatch([&](asio::error_code ec, dbus::message m) {
+    EXPECT_FALSE(ec);
+    received = m.get_member();
+    io.stop();
+  });
+  dbus::match other(listener, rule_for("Other"));
+  emit(emitter, "Pending");
+  emit(emitter, "Other");
+  io.restart();
+  io.run_for(5s);
+  EXPECT_EQ(received, "Other");
+}
+
+TEST(MatchTest, SignalHubFansOut) {
+  asio::io_context io;
+  dbus::connection listener(io, dbus::bus::session);
+  dbus::connection emitter(io, dbus::bus::session);
+
+  dbus::signal_hub hub(listener, dbus::route{dbus::message_type::signal,
+                                             test_interface, "Fan"});
+  auto strand = asio::make_strand(io);
+  std::vector<std::string> first, second;
+  auto a = hub.subscribe([&](const dbus::message& m) {
+    first.push_back(m.get_member());
+  });
+  auto b = hub.subscribe(strand, [&](const dbus::message& m) {
+    std::string s;
+    EXPECT_TRUE(m.unpack(s));
+    second.push_back(s);
+    if (second.size() == 2) io.stop();
+  });
+  EXPECT_EQ(hub.size(), 2u);
+
+  auto send = [&](const std::string& s) {
+    dbus::message m = dbus::message::new_signal(
+        dbus::endpoint("", "/com/test/match", test_interface), "Fan");
+    m.pack(s);
+    emitter.async_send(m, [](asio::error_code, dbus::message) {});
+  };
+
+  asio::error_code installed = asio::error::would_block;
+  dbus::match rule(listener, rule_for("Fan"), [&](asio::error_code ec) {
+    installed = ec;
+    send("one");
+    send("two");
+  });
+  io.run_for(5s);
+  EXPECT_FALSE(installed);
+  EXPECT_EQ(first, (std::vector<std::string>{"Fan", "Fan"}));
+  EXPECT_EQ(second, (std::vector<std::string>{"one", "two"}));
+
+  // only the remaining subscriber sees the next one
+  a.reset();
+  EXPECT_EQ(hub.size(), 1u);
+  int third = 0;
+  auto c = hub.subscribe(io, [&](const dbus::message&) {
+    ++third;
+    io.stop();
+  });
+  send("three");
+  io.restart();
+  io.run_for(5s);
+  io.restart();
+  io.poll();
+  EXPECT_EQ(first.size(), 2u);
+  EXPECT_EQ(second.size(), 3u);
+  EXPECT_EQ(third, 1);
+}
@@ -9,6 +9,11 @@
 #include <dbus/filter.hpp>
 #include <dbus/match.hpp>
 #include <dbus/message.hpp>
+#include <dbus/message_template.hpp>
+#include <map>
+#include <string_view>
+#include <vector>
+
 #include <gtest/gtest.h>
 
 TEST(MessageTest, CallMessage) {
@@ -91,3 +96,243 @@ TEST(MessageTest, ErrorMessage)
   e.throw_if_set();
 }
 */
+
+TEST(MessageTest, FixedArrays) {
+  dbus::message m = dbus::message::new_call(
+      dbus::endpoint("org.test", "/", "org.test.Interface"), "Blob");
+
+  std::vector<dbus::byte> blob(1 << 20);
+  for (std::size_t i = 0; i < blob.size(); ++i) blob[i] = i * 7;
+  std::vector<double> wave{0.0, 0.5, -1.25, 1e300};
+  std::array<dbus::int32, 3> ints{{-1, 0, 1}};
+
+  ASSERT_TRUE(m.pack(blob, wave, ints));
+  EXPECT_EQ(m.get_signature(), "ayadai");
+
+  std::vector<dbus::byte> blob_out;
+  std::vector<double> wave_out;
+  std::vector<dbus::int32> ints_out;
+  ASSERT_TRUE(m.unpack(blob_out, wave_out, ints_out));
+  EXPECT_EQ(blob_out, blob);
+  EXPECT_EQ(wave_out, wave);
+  EXPECT_EQ(ints_out, std::vector<dbus::int32>(ints.begin(), ints.end()));
+
+  std::vector<dbus::uint64> empty;
+  dbus::message e = dbus::message::new_call(
+      dbus::endpoint("org.test", "/", "org.test.Interface"), "Empty");
+  ASSERT_TRUE(e.pack(empty));
+  EXPECT_EQ(e.get_signature(), "at");
+}
+
+#if defined(__cpp_lib_span)
+TEST(MessageTest, FixedArraySpans) {
+  dbus::message m = dbus::message::new_call(
+      dbus::endpoint("org.test", "/", "org.test.Interface"), "Blob");
+
+  std::vector<dbus::int32> ints{-1, 0, 1, 2};
+  std::span<const dbus::int32> all(ints);
+  std::span<dbus::int32, 2> middle(ints.data() + 1, 2);
+  ASSERT_TRUE(m.pack(all, middle));
+  EXPECT_EQ(m.get_signature(), "aiai");
+
+  std::vector<dbus::int32> all_out, middle_out;
+  ASSERT_TRUE(m.unpack(all_out, middle_out));
+  EXPECT_EQ(all_out, ints);
+  EXPECT_EQ(middle_out, (std::vector<dbus::int32>{0, 1}));
+}
+#endif
+
+TEST(MessageTest, FixedArrayViews) {
+  dbus::message m = dbus::message::new_call(
+      dbus::endpoint("org.test", "/", "org.test.Interface"), "Blob");
+
+  std::vector<dbus::byte> blob{1, 2, 3, 4, 5};
+  std::vector<dbus::uint32> words{7, 8, 9};
+  ASSERT_TRUE(m.pack(blob, words));
+
+  dbus::array_view<dbus::byte> blob_view;
+  dbus::array_view<dbus::uint32> words_view;
+  ASSERT_TRUE(m.unpack(blob_view, words_view));
+  EXPECT_EQ(std::vector<dbus::byte>(blob_view.begin(), blob_view.end()), blob);
+  EXPECT_EQ(std::vector<dbus::uint32>(words_view.begin(), words_view.end()),
+            words);
+
+  // the element type is checked
+  dbus::array_view<dbus::int64> wrong;
+  EXPECT_FALSE(m.unpack(wrong));
+
+  // views pack like any other fixed array
+  dbus::message copy = dbus::message::new_call(
+      dbus::endpoint("org.test", "/", "org.test.Interface"), "Copy");
+  ASSERT_TRUE(copy.pack(words_view));
+  EXPECT_EQ(copy.get_signature(), "au");
+  std::vector<dbus::uint32> words_out;
+  ASSERT_TRUE(copy.unpack(words_out));
+  EXPECT_EQ(words_out, words);
+}
+
+TEST(MessageTest, StringViews) {
+  dbus::message m = dbus::message::new_call(
+      dbus::endpoint("org.test", "/", "org.test.Interface"), "Views");
+
+  std::vector<std::pair<std::string, dbus::dbus_variant>> props{
+      {"Name", std::string("test")}, {"Count", 3}};
+  std::vector<dbus::object_path> paths{{"/a"}, {"/a/b"}};
+  ASSERT_TRUE(m.pack(props, paths, std::string("hello"),
+                     std::string_view("view")));
+
+  std::map<std::string_view, dbus::dbus_variant> props_out;
+  std::vector<dbus::object_path_view> paths_out;
+  std::string_view hello, view;
+  ASSERT_TRUE(m.unpack(props_out, paths_out, hello, view));
+
+  ASSERT_EQ(props_out.size(), 2u);
+  EXPECT_EQ(std::get<std::string>(props_out["Name"]), "test");
+  EXPECT_EQ(std::get<dbus::int32>(props_out["Count"]), 3);
+  ASSERT_EQ(paths_out.size(), 2u);
+  EXPECT_EQ(paths_out[1].value, "/a/b");
+  EXPECT_EQ(hello, "hello");
+  EXPECT_EQ(view, "view");
+
+  // string views are type checked like strings
+  dbus::message s = dbus::message::new_call(
+      dbus::endpoint("org.test", "/", "org.test.Interface"), "Sig");
+  ASSERT_TRUE(s.pack(dbus::object_path{"/x"}));
+  dbus::signature_view sig;
+  EXPECT_FALSE(s.unpack(sig));
+  dbus::object_path_view path;
+  ASSERT_TRUE(s.unpack(path));
+  EXPECT_EQ(path.value, "/x");
+}
+
+TEST(MessageTest, MapsUpdateInPlace) {
+  dbus::message m = dbus::message::new_call(
+      dbus::endpoint("org.test", "/", "org.test.Interface"), "Maps");
+
+  std::vector<std::pair<std::string, dbus::dbus_variant>> props{
+      {"Name", std::string("new")}, {"Count", 3}};
+  std::vector<std::pair<std::string, std::vector<dbus::int32>>> lists{
+      {"a", {1, 2}}};
+  ASSERT_TRUE(m.pack(props, lists));
+
+  std::map<std::string, dbus::dbus_variant> cache{
+      {"Name", std::string("old")}, {"Kept", true}};
+  std::map<std::string, std::vector<dbus::int32>> lists_out{{"a", {9, 9, 9}}};
+  ASSERT_TRUE(m.unpack(cache, lists_out));
+
+  ASSERT_EQ(cache.size(), 3u);
+  EXPECT_EQ(std::get<std::string>(cache["Name"]), "new");
+  EXPECT_EQ(std::get<dbus::int32>(cache["Count"]), 3);
+  EXPECT_EQ(std::get<bool>(cache["Kept"]), true);
+  // values are replaced, not appended to
+  EXPECT_EQ(lists_out["a"], (std::vector<dbus::int32>{1, 2}));
+
+  // also when the container is inside a struct
+  typedef std::tuple<std::string, std::vector<dbus::int32>> tagged;
+  dbus::message t = dbus::message::new_call(
+      dbus::endpoint("org.test", "/", "org.test.Interface"), "Nested");
+  ASSERT_TRUE(t.pack(std::map<std::string, tagged>{{"a", {"new", {1, 2}}}}));
+  std::map<std::string, tagged> tagged_out{{"a", {"old", {9, 9, 9}}}};
+  ASSERT_TRUE(t.unpack(tagged_out));
+  EXPECT_EQ(tagged_out["a"], (tagged{"new", {1, 2}}));
+
+  // a type mismatch fails without leaving a half decoded entry behind
+  std::map<std::string, std::string> wrong;
+  EXPECT_FALSE(m.unpack(wrong));
+  EXPECT_TRUE(wrong.empty());
+}
+
+TEST(MessageTest, SignatureFastPath) {
+  dbus::message m = dbus::message::new_call(
+      dbus::endpoint("org.test", "/", "org.test.Interface"), "Sig");
+  std::vector<std::pair<std::string, dbus::dbus_variant>> props{{"a", 1}};
+  ASSERT_TRUE(m.pack(std::string("s"), props, dbus::uint32(7)));
+
+  EXPECT_TRUE((m.has_signature<std::string, std::map<std::string,
+                                                     dbus::dbus_variant>,
+                               dbus::uint32>()));
+  EXPECT_FALSE((m.has_signature<std::string, dbus::uint32>()));
+  EXPECT_TRUE((validate_args_num<std::tuple<std::string, decltype(props),
+                                            dbus::uint32>>(m)));
+
+  // whole body: one signature comparison
+  std::string s;
+  std::map<std::string, dbus::dbus_variant> out;
+  dbus::uint32 u = 0;
+  ASSERT_TRUE(m.unpack(s, out, u));
+  EXPECT_EQ(u, 7u);
+
+  // leading arguments only, or wrong types: checked element by element
+  std::string prefix;
+  EXPECT_TRUE(m.unpack(prefix));
+  EXPECT_EQ(prefix, "s");
+  dbus::int32 wrong;
+  EXPECT_FALSE(m.unpack(prefix, out, wrong));
+}
+
+TEST(MessageTest, Structs) {
+  typedef std::tuple<std::string, double, dbus::uint64> reading;
+  std::vector<reading> readings;
+  for (int i = 0; i < 1000; ++i) {
+    readings.emplace_back("sensor" + std::to_string(i), i * 0.5, i);
+  }
+
+  dbus::message m = dbus::message::new_signal(
+      dbus::endpoint("org.test", "/", "org.test.Interface"), "Readings");
+  ASSERT_TRUE(m.pack(readings, std::tuple<dbus::int32, std::tuple<bool>>{
+                                   -1, std::tuple<bool>{true}}));
+  EXPECT_EQ(m.get_signature(), "a(sdt)(i(b))");
+
+  std::vector<reading> out;
+  std::tuple<dbus::int32, std::tuple<bool>> nested;
+  ASSERT_TRUE(m.unpack(out, nested));
+  EXPECT_EQ(out, readings);
+  EXPECT_EQ(std::get<0>(nested), -1);
+  EXPECT_TRUE(std::get<0>(std::get<1>(nested)));
+
+  std::vector<std::tuple<std::string, dbus::int32, dbus::uint64>> wrong;
+  EXPECT_FALSE(m.unpack(wrong));
+}
+
+TEST(MessageTest, Template) {
+  auto tmpl = dbus::message_template::call(
+      dbus::endpoint("org.test", "/org/test", "org.test.Interface", "Poll"));
+
+  dbus::message a = tmpl.create(dbus::int32(1));
+  dbus::message b = tmpl.create(std::string("two"));
+  ASSERT_TRUE(a != nullptr);
+  ASSERT_TRUE(b != nullptr);
+
+  EXPECT_EQ(a.get_member(), "Poll");
+  EXPECT_EQ(b.get_destination(), "org.test");
+  EXPECT_EQ(a.get_serial(), 0u);
+  EXPECT_EQ(a.get_signature(), "i");
+  EXPECT_EQ(b.get_signature(), "s");
+  // the prototype is left alone
+  EXPECT_EQ(tmpl.create().get_signature(), "");
+}
+
+TEST(MessageTest, HeaderViews) {
+  dbus::message m = dbus::message::new_call(
+      dbus::endpoint("org.test", "/org/test", "org.test.Interface"), "Poll");
+  ASSERT_TRUE(m.pack(dbus::int32(1)));
+
+  EXPECT_EQ(m.get_message_type(), dbus::message_type::method_call);
+  EXPECT_EQ(m.get_path_view(), "/org/test");
+  EXPECT_EQ(m.get_interface_view(), "org.test.Interface");
+  EXPECT_EQ(m.get_member_view(), "Poll");
+  EXPECT_EQ(m.get_destination_view(), "org.test");
+  EXPECT_EQ(m.get_signature_view(), "i");
+  // unset fields are empty rather than "(null)"
+  EXPECT_EQ(m.get_sender_view(), "");
+  EXPECT_EQ(m.get_sender(), "(null)");
+
+  EXPECT_TRUE(m.is_method_call("org.test.Interface", "Poll"));
+  EXPECT_FALSE(m.is_method_call("org.test.Interface", "Pol"));
+  EXPECT_FALSE(m.is_signal("org.test.Interface", "Poll"));
+
+  dbus::message s = dbus::message::new_signal(
+      dbus::endpoint("", "/org/test", "org.test.Interface"), "Changed");
+  EXPECT_EQ(s.get_message_type(), dbus::message_type::signal);
+  EXPECT_TRUE(s.is_signal("org.test.Interface", "Changed"));
+}
@@ -0,0 +1,83 @@
+// Copyright (c) Benjamin Kietzman (github.com/bkietz)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+#include <dbus/detail/timer_wheel.hpp>
+#include <chrono>
+#include <memory>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+using namespace std::literals;
+
+namespace {
+
+struct recorded : dbus::detail::timer_wheel::entry {
+  int id;
+  std::vector<int>* fired;
+  std::chrono::steady_clock::time_point at;
+
+  recorded(int i, std::vector<int>& f) : entry(&callback), id(i), fired(&f) {}
+
+  static void callback(entry& e) {
+    auto& self = static_cast<recorded&>(e);
+    self.fired->push_back(self.id);
+    self.at = std::chrono::steady_clock::now();
+  }
+};
+
+}  // namespace
+
+TEST(TimerWheelTest, FiresInOrderAcrossLevels) {
+  asio::io_context io;
+  dbus::detail::dispatch_context ctx(io, false);
+  auto wheel = std::make_shared<dbus::detail::timer_wheel>(ctx);
+
+  std::vector<int> fired;
+  recorded a(1, fired), b(2, fired), c(3, fired), removed(4, fired);
+
+  auto start = std::chrono::steady_clock::now();
+  // 300ms lands on the second level and has to be cascaded
+  wheel->add(c, 300ms);
+  wheel->add(a, 10ms);
+  wheel->add(b, 80ms);
+  wheel->add(removed, 20ms);
+  wheel->remove(removed);
+  EXPECT_EQ(wheel->size(), 3u);
+
+  io.run();
+
+  EXPECT_EQ(fired, (std::vector<int>{1, 2, 3}));
+  EXPECT_GE(a.at - start, 10ms);
+  EXPECT_GE(b.at - start, 80ms);
+  EXPECT_GE(c.at - start, 300ms);
+  EXPECT_FALSE(removed.is_linked());
+  EXPECT_EQ(wheel->size(), 0u);
+}
+
+TEST(TimerWheelTest, RescheduleFromCallback) {
+  asio::io_context io;
+  dbus::detail::dispatch_context ctx(io, false);
+  auto wheel = std::make_shared<dbus::detail::timer_wheel>(ctx);
+
+  struct periodic : dbus::detail::timer_wheel::entry {
+    std::shared_ptr<dbus::detail::timer_wheel> wheel;
+    int count = 0;
+    explicit periodic(std::shared_ptr<dbus::detail::timer_wheel> w)
+        : entry(&callback), wheel(std::move(w)) {}
+    static void callback(entry& e) {
+      auto& self = static_cast<periodic&>(e);
+      if (++self.count < 5) self.wheel->add(self, 5ms);
+    }
+  } p(wheel);
+
+  // moving a scheduled entry keeps only the latest deadline
+  wheel->add(p, 1h);
+  wheel->add(p, 5ms);
+  EXPECT_EQ(wheel->size(), 1u);
+
+  io.run();
+  EXPECT_EQ(p.count, 5);
+}
@@ -0,0 +1,174 @@
+// Copyright (c) Benjamin Kietzman (github.com/bkietz)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+#include <dbus/connection.hpp>
+#include <dbus/endpoint.hpp>
+#include <dbus/filter.hpp>
+#include <dbus/match.hpp>
+#include <dbus/message.hpp>
+#include <dbus/wire.hpp>
+#include <map>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+namespace {
+
+typedef std::map<std::string, dbus::dbus_variant> properties;
+typedef std::vector<std::tuple<std::string, double, dbus::uint64>> readings;
+
+dbus::message new_call() {
+  return dbus::message::new_call(
+      dbus::endpoint("org.test", "/org/test", "org.test.Interface"), "Wire");
+}
+
+}  // namespace
+
+TEST(WireTest, MarshalMatchesIterators) {
+  properties props{{"Name", std::string("x")}, {"On", true}, {"Big", 1e9}};
+  readings rs{{"a", 0.5, 1}, {"b", 1.5, 2}};
+  std::vector<dbus::byte> blob{1, 2, 3};
+  std::vector<std::vector<std::string>> nested{{"a", "b"}, {}, {"c"}};
+
+  dbus::message header = new_call();
+  dbus::message m = dbus::wire::marshal(header, dbus::int16(-2), props, rs,
+                                        blob, nested, dbus::object_path{"/p"});
+  ASSERT_TRUE(m != nullptr);
+  EXPECT_EQ(m.get_signature(), "na{sv}a(sdt)ayaaso");
+  EXPECT_EQ(m.get_member(), "Wire");
+  EXPECT_EQ(m.get_path(), "/org/test");
+  EXPECT_EQ(m.get_serial(), 0u);
+
+  // libdbus reads what the native writer produced
+  dbus::int16 n;
+  properties props_out;
+  readings rs_out;
+  std::vector<dbus::byte> blob_out;
+  std::vector<std::vector<std::string>> nested_out;
+  dbus::object_path path;
+  ASSERT_TRUE(m.unpack(n, props_out, rs_out, blob_out, nested_out, path));
+  EXPECT_EQ(n, -2);
+  EXPECT_EQ(props_out, props);
+  EXPECT_EQ(rs_out, rs);
+  EXPECT_EQ(blob_out, blob);
+  EXPECT_EQ(nested_out, nested);
+  EXPECT_EQ(path.value, "/p");
+}
+
+TEST(WireTest, UnmarshalMatchesIterators) {
+  properties props{{"Name", std::string("x")}, {"Count", dbus::uint32(3)}};
+  std::vector<double> wave{0.25, -0.5};
+
+  dbus::message m = new_call();
+  ASSERT_TRUE(m.pack(std::string("s"), props, wave, true));
+
+  std::string s;
+  properties props_out;
+  std::vector<double> wave_out;
+  bool b = false;
+  ASSERT_TRUE(dbus::wire::unmarshal(m, s, props_out, wave_out, b));
+  EXPECT_EQ(s, "s");
+  EXPECT_EQ(props_out, props);
+  EXPECT_EQ(wave_out, wave);
+  EXPECT_TRUE(b);
+
+  // the whole body has to match
+  EXPECT_FALSE(dbus::wire::unmarshal(m, s));
+
+  // map values are overwritten in place, including containers in structs
+  typedef std::tuple<std::string, std::vector<dbus::int32>> tagged;
+  dbus::message t = new_call();
+  ASSERT_TRUE(t.pack(std::map<std::string, tagged>{{"a", {"new", {1, 2}}}}));
+  std::map<std::string, tagged> tagged_out{{"a", {"old", {9, 9, 9}}},
+                                           {"b", {"kept", {}}}};
+  ASSERT_TRUE(dbus::wire::unmarshal(t, tagged_out));
+  EXPECT_EQ(tagged_out["a"], (tagged{"new", {1, 2}}));
+  EXPECT_EQ(std::get<0>(tagged_out["b"]), "kept");
+}
+
+TEST(WireTest, ReaderRejectsTruncatedInput) {
+  std::string buffer;
+  dbus::wire::writer w(buffer);
+  ASSERT_TRUE(w.write(std::string("hello"), std::vector<dbus::uint32>{1, 2}));
+
+  for (std::size_t size = 0; size < buffer.size(); ++size) {
+    dbus::wire::reader r(buffer.data(), size);
+    std::string s;
+    std::vector<dbus::uint32> v;
+    EXPECT_FALSE(r.read(s, v));
+  }
+
+  dbus::wire::reader r(buffer.data(), buffer.size());
+  std::string_view s;
+  dbus::array_view<dbus::uint32> v;
+  ASSERT_TRUE(r.read(s, v));
+  EXPECT_TRUE(r.at_end());
+  EXPECT_EQ(s, "hello");
+  ASSERT_EQ(v.size(), 2u);
+  EXPECT_EQ(v[1], 2u);
+}
+
+TEST(WireTest, ReaderLimitsNesting) {
+  // variants holding variants, with a byte at the bottom
+  auto nested = [](std::size_t depth) {
+    std::string buffer;
+    for (std::size_t i = 0; i < depth; ++i) buffer.append("\1v\0", 3);
+    buffer.append("\1y\0\x2a", 4);
+    return buffer;
+  };
+
+  std::string shallow = nested(DBUS_MAXIMUM_TYPE_RECURSION_DEPTH);
+  dbus::wire::reader ok(shallow.data(), shallow.size());
+  dbus::dbus_variant v;
+  EXPECT_TRUE(ok.get(v));
+  EXPECT_TRUE(ok.at_end());
+
+  std::string deep = nested(2 * DBUS_MAXIMUM_TYPE_RECURSION_DEPTH);
+  dbus::wire::reader too_deep(deep.data(), deep.size());
+  EXPECT_FALSE(too_deep.get(v));
+
+  // fails at the limit instead of overflowing the stack
+  std::string hostile = nested(1000000);
+  dbus::wire::reader r(hostile.data(), hostile.size());
+  EXPECT_FALSE(r.get(v));
+
+  // an empty array of arrays of bytes, in a variant
+  auto arrays = [](std::size_t depth) {
+    std::string buffer(1, static_cast<char>(depth + 1));
+    buffer.append(depth, 'a');
+    buffer.append("y", 2);
+    buffer.append((4 - buffer.size() % 4) % 4, '\0');
+    buffer.append(4, '\0');
+    return buffer;
+  };
+  std::string limit = arrays(DBUS_MAXIMUM_TYPE_RECURSION_DEPTH);
+  dbus::wire::reader at_limit(limit.data(), limit.size());
+  EXPECT_TRUE(at_limit.get(v));
+  EXPECT_TRUE(at_limit.at_end());
+
+  std::string beyond = arrays(DBUS_MAXIMUM_TYPE_RECURSION_DEPTH + 1);
+  dbus::wire::reader past_limit(beyond.data(), beyond.size());
+  EXPECT_FALSE(past_limit.get(v));
+}
+
+TEST(WireTest, MarshalledMessagesCanBeSent) {
+  asio::io_context io;
+  dbus::connection bus(io, dbus::bus::session);
+
+  dbus::message header = dbus::message::new_call(
+      dbus::endpoint("org.freedesktop.DBus", "/org/freedesktop/DBus",
+                     "org.freedesktop.DBus"),
+      "NameHasOwner");
+  dbus::message m =
+      dbus::wire::marshal(header, std::string("org.freedesktop.DBus"));
+  ASSERT_TRUE(m != nullptr);
+
+  dbus::message reply = bus.send(m);
+  bool has_owner = false;
+  ASSERT_TRUE(dbus::wire::unmarshal(reply, has_owner));
+  EXPECT_TRUE(has_owner);
+}